@@ -0,0 +1,211 @@
+//
+//  NtpFilter.c
+//
+//  Author: Filippin luca
+//  luca.filippin@gmail.com
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdint.h>
+#include "NtpFilter.h"
+
+#define DEBUG_BASIC     0x01
+#define DEBUG_MEDIUM    0x02
+#define DEBUG_DEEP      0x04
+
+#define DEBUG_SWITCH    DEBUG_BASIC + DEBUG_MEDIUM
+#include "DebugUtil.h"
+
+#define NTPFILTER_HEADER   "NTP-FILTER"
+#define NTPFILTER_DBG(fmt, ...) eprintf(NTPFILTER_HEADER, fmt, __VA_ARGS__)
+
+#define AGE(d, dt)      ((d) + (dt) * NTP_FILTER_PHI / 1000000)   // dispersion grown over dt [ns]
+#define ABS(a)          ((a) < 0 ? -(a) : (a))
+
+void ntp_filter_init(tNtpFilter *f, int64_t precision) {
+    memset(f, 0, sizeof(tNtpFilter));
+    f->precision = precision;
+}
+
+int ntp_filter_add(tNtpFilter *f, const tNtpSample *s, int64_t poll) {
+    tNtpSample sorted[NTP_FILTER_STAGES], tmp;
+    int64_t now = s->t, disp;
+    double jitter = 0, d;
+    int i, j;
+
+    memmove(&f->stage[1], &f->stage[0], (NTP_FILTER_STAGES - 1) * sizeof(tNtpSample));
+    f->stage[0] = *s;
+    f->n += f->n < NTP_FILTER_STAGES;
+
+    // by delay, with the dispersion aged up to now
+    for (i = 0; i < f->n; i++) {
+        tmp = f->stage[i];
+        tmp.dispersion = AGE(tmp.dispersion, now - tmp.t);
+
+        for (j = i; j > 0 && sorted[j - 1].delay > tmp.delay; j--)
+            sorted[j] = sorted[j - 1];
+        sorted[j] = tmp;
+    }
+
+    // the empty stages weigh as the most dispersed ones
+    for (disp = 0, i = 0; i < NTP_FILTER_STAGES; i++)
+        disp += (i < f->n ? sorted[i].dispersion : NTP_FILTER_MAXDISP) >> (i + 1);
+
+    for (i = 1; i < f->n; i++) {
+        d = (double)(sorted[i].offset - sorted[0].offset);
+        jitter += d * d;
+    }
+
+    // the statistics of the register are always current, the sample in output only changes when used
+    f->dispersion = disp;
+    f->jitter = f->n > 1 ? (int64_t)sqrt(jitter / (f->n - 1)) : 0;
+    f->jitter = f->jitter > f->precision ? f->jitter : f->precision;
+    f->t_eval = now;
+
+    // use a sample only once, and never one older than the last one used
+    if (f->t != 0 && sorted[0].t <= f->t)
+        return 0;
+
+    // popcorn spike: a jump far out of the jitter, unless it lasts for a couple of clock updates
+    if (f->t != 0 && ABS(sorted[0].offset - f->offset) > NTP_FILTER_SGATE * f->jitter && sorted[0].t - f->t < 2 * poll) {
+        f->spikes++;
+        DEBUG_LEVEL(DEBUG_MEDIUM, NTPFILTER_DBG("-- Popcorn spike suppressed: offset = %.9f, previous = %.9f, jitter = %.9f\n", sorted[0].offset / 1e9, f->offset / 1e9, f->jitter / 1e9));
+        return 0;
+    }
+
+    f->offset = sorted[0].offset;
+    f->delay = sorted[0].delay;
+    f->t = sorted[0].t;
+    DEBUG_LEVEL(DEBUG_DEEP, NTPFILTER_DBG("-- Offset = %.9f, delay = %.9f, dispersion = %.9f, jitter = %.9f (%d stages)\n", f->offset / 1e9, f->delay / 1e9, f->dispersion / 1e9, f->jitter / 1e9, f->n));
+    return 1;
+}
+
+void ntp_filter_slew(tNtpFilter *f, int64_t offset) {
+    int i;
+
+    for (i = 0; i < f->n; i++)
+        f->stage[i].offset -= offset;
+    f->offset -= offset;
+}
+
+int64_t ntp_filter_dispersion(const tNtpFilter *f, int64_t now) {
+    return AGE(f->dispersion, now - f->t_eval);
+}
+
+void ntp_huffpuff_init(tNtpHuffPuff *h, int64_t window) {
+    int i;
+
+    memset(h, 0, sizeof(tNtpHuffPuff));
+    h->window = window;
+
+    for (i = 0; i < NTP_HUFFPUFF_BUCKETS; i++)
+        h->bucket[i] = INT64_MAX;
+    h->min_delay = INT64_MAX;
+}
+
+void ntp_huffpuff_add(tNtpHuffPuff *h, int64_t delay, int64_t now) {
+    int64_t len = h->window / NTP_HUFFPUFF_BUCKETS;
+    int i, n = 0;
+
+    if (h->window <= 0)
+        return;
+
+    if (h->t_bucket == 0)
+        h->t_bucket = now;
+
+    // the oldest slice leaves the window
+    while (now - h->t_bucket >= len && n++ < NTP_HUFFPUFF_BUCKETS) {
+        h->ptr = (h->ptr + 1) % NTP_HUFFPUFF_BUCKETS;
+        h->bucket[h->ptr] = INT64_MAX;
+        h->t_bucket += len;
+    }
+
+    if (n > NTP_HUFFPUFF_BUCKETS) // idle for longer than the window
+        h->t_bucket = now;
+
+    h->bucket[h->ptr] = delay < h->bucket[h->ptr] ? delay : h->bucket[h->ptr];
+
+    for (h->min_delay = INT64_MAX, i = 0; i < NTP_HUFFPUFF_BUCKETS; i++)
+        h->min_delay = h->bucket[i] < h->min_delay ? h->bucket[i] : h->min_delay;
+}
+
+int64_t ntp_huffpuff_correct(tNtpHuffPuff *h, int64_t offset, int64_t delay) {
+
+    if (h->window <= 0 || h->min_delay == INT64_MAX || delay < h->min_delay)
+        return offset;
+
+    h->correction = offset > 0 ? -(delay - h->min_delay) / 2 : (delay - h->min_delay) / 2;
+
+    DEBUG_LEVEL(DEBUG_DEEP, NTPFILTER_DBG("-- Huff-n'-puff: delay = %.9f, minimum = %.9f, offset = %.9f corrected by %.9f\n", delay / 1e9, h->min_delay / 1e9, offset / 1e9, h->correction / 1e9));
+    return offset + h->correction;
+}
+
+static int _cmp_int64(const void *a, const void *b) {
+    int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+// Median and median absolute deviation of v (which gets sorted)
+static int64_t _median_mad(int64_t *v, int n, int64_t *pMad) {
+    int64_t dev[NTP_GATE_HISTORY], median;
+    int i;
+
+    qsort(v, n, sizeof(int64_t), _cmp_int64);
+    median = n & 1 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+
+    for (i = 0; i < n; i++)
+        dev[i] = ABS(v[i] - median);
+
+    qsort(dev, n, sizeof(int64_t), _cmp_int64);
+    *pMad = n & 1 ? dev[n / 2] : (dev[n / 2 - 1] + dev[n / 2]) / 2;
+    return median;
+}
+
+void ntp_gate_init(tNtpGate *g, double k, int64_t mad_min) {
+    memset(g, 0, sizeof(tNtpGate));
+    g->k = k;
+    g->mad_min = mad_min;
+}
+
+int ntp_gate_check(tNtpGate *g, const tNtpSample *s) {
+    int64_t v[NTP_GATE_HISTORY], ofs_med, ofs_mad, dly_med, dly_mad;
+    int rejected = 0;
+
+    if (g->k > 0 && g->n >= NTP_GATE_MIN) {
+        memcpy(v, g->offset, g->n * sizeof(int64_t));
+        ofs_med = _median_mad(v, g->n, &ofs_mad);
+        memcpy(v, g->delay, g->n * sizeof(int64_t));
+        dly_med = _median_mad(v, g->n, &dly_mad);
+
+        ofs_mad = ofs_mad > g->mad_min ? ofs_mad : g->mad_min;
+        dly_mad = dly_mad > g->mad_min ? dly_mad : g->mad_min;
+
+        if (ABS(s->offset - ofs_med) > g->k * ofs_mad) {
+            g->rejected_offset++;
+            rejected = 1;
+        }
+
+        if (s->delay - dly_med > g->k * dly_mad) {
+            g->rejected_delay++;
+            rejected = 1;
+        }
+
+        DEBUG_LEVEL(DEBUG_MEDIUM, if (rejected) NTPFILTER_DBG("-- Outlier rejected: offset = %.9f (median %.9f, MAD %.9f), delay = %.9f (median %.9f, MAD %.9f)\n", s->offset / 1e9, ofs_med / 1e9, ofs_mad / 1e9, s->delay / 1e9, dly_med / 1e9, dly_mad / 1e9));
+    }
+
+    g->offset[g->ptr] = s->offset;
+    g->delay[g->ptr] = s->delay;
+    g->ptr = (g->ptr + 1) % NTP_GATE_HISTORY;
+    g->n += g->n < NTP_GATE_HISTORY;
+    return rejected;
+}
+
+void ntp_gate_slew(tNtpGate *g, int64_t offset) {
+    int i;
+
+    for (i = 0; i < g->n; i++)
+        g->offset[i] -= offset;
+}
@@ -0,0 +1,103 @@
+//
+//  NtpFilter.h
+//
+//  Author: Filippin luca
+//  luca.filippin@gmail.com
+//
+//  The clock filter of rfc5905 (appendix A.5.2): a shift register of the most recent samples
+//  of a server, whose dispersion grows with their age. The sample of least delay is the one
+//  used, once only and never when older than the last one used, unless it is a popcorn spike.
+//  The huff-n'-puff filter corrects the offsets measured on congested, asymmetric paths, the
+//  gate rejects the samples out of the median/MAD band of the recent ones.
+//
+
+#ifndef __NTPFILTER_H__
+#define __NTPFILTER_H__
+
+#include <stdint.h>
+
+#define NTP_FILTER_STAGES       8
+#define NTP_FILTER_MAXDISP      16000000000LL   // dispersion of an empty stage [ns]
+#define NTP_FILTER_PHI          15              // frequency tolerance [ppm]
+#define NTP_FILTER_SGATE        3               // spike gate, in jitters
+#define NTP_HUFFPUFF_BUCKETS    8               // the window of the minimum delay slides a bucket at a time
+#define NTP_GATE_HISTORY        32              // samples the median and the MAD are taken on
+#define NTP_GATE_MIN            8               // samples in the history before the gate closes
+
+typedef struct {
+    int64_t offset;         // [ns]
+    int64_t delay;          // [ns]
+    int64_t dispersion;     // at the time of the sample [ns]
+    int64_t t;              // local clock of the sample [ns]
+} tNtpSample;
+
+typedef struct {
+    tNtpSample stage[NTP_FILTER_STAGES]; // the most recent first
+    int n;                  // stages filled
+    int64_t precision;      // floor of the jitter [ns]
+
+    // -- output: the last sample used
+    int64_t offset;         // [ns]
+    int64_t delay;          // [ns]
+    int64_t dispersion;     // of the register when evaluated [ns]
+    int64_t jitter;         // [ns]
+    int64_t t;              // local clock of the sample, 0 if none yet [ns]
+    int64_t t_eval;         // local clock of the evaluation [ns]
+    uint64_t spikes;        // popcorn spikes suppressed
+} tNtpFilter;
+
+void ntp_filter_init(tNtpFilter *f, int64_t precision);
+
+// Shift in a sample and evaluate the register: 1 if its best sample is newer than the output and
+// not a spike (the output is updated), 0 if not. poll is the interval of the clock updates [ns].
+int ntp_filter_add(tNtpFilter *f, const tNtpSample *s, int64_t poll);
+
+// The clock moved by offset: the samples measured before are relative to the previous one
+void ntp_filter_slew(tNtpFilter *f, int64_t offset);
+
+// Dispersion of the output aged up to the local time now [ns]
+int64_t ntp_filter_dispersion(const tNtpFilter *f, int64_t now);
+
+// Huff-n'-puff: the delay above the minimum seen within the window is queueing, which the offset formula
+// splits evenly in between the two ways. Congestion being mostly on one way, the offset is biased by up
+// to half of it: the sign of the offset tells which way, and the bias is taken out.
+typedef struct {
+    int64_t window;         // [ns], 0 when disabled
+    int64_t bucket[NTP_HUFFPUFF_BUCKETS]; // minimum delay of each slice of the window [ns]
+    int ptr;                // current bucket
+    int64_t t_bucket;       // local clock the current bucket started at [ns]
+    int64_t min_delay;      // minimum within the window [ns]
+    int64_t correction;     // last one applied [ns]
+} tNtpHuffPuff;
+
+void ntp_huffpuff_init(tNtpHuffPuff *h, int64_t window);
+
+// Track the delay of a sample measured at the local time now
+void ntp_huffpuff_add(tNtpHuffPuff *h, int64_t delay, int64_t now);
+
+// The offset of a sample of delay, corrected [ns]
+int64_t ntp_huffpuff_correct(tNtpHuffPuff *h, int64_t offset, int64_t delay);
+
+// Gate: a sample whose offset is more than k MADs from the median offset of the recent samples, or whose
+// delay is more than k MADs above their median delay, is rejected. All the samples enter the history,
+// so that a lasting change of the path moves the median, and the gate opens to it, in a few bursts.
+typedef struct {
+    int64_t offset[NTP_GATE_HISTORY]; // [ns]
+    int64_t delay[NTP_GATE_HISTORY];  // [ns]
+    int n;                  // samples in the history
+    int ptr;                // next one to replace
+    double k;               // width of the band [MADs], 0 when off
+    int64_t mad_min;        // floor of the MAD [ns]
+    uint64_t rejected_offset;
+    uint64_t rejected_delay;
+} tNtpGate;
+
+void ntp_gate_init(tNtpGate *g, double k, int64_t mad_min);
+
+// 0 if the sample passes, 1 if it is rejected
+int ntp_gate_check(tNtpGate *g, const tNtpSample *s);
+
+// The clock moved by offset: the samples measured before are relative to the previous one
+void ntp_gate_slew(tNtpGate *g, int64_t offset);
+
+#endif
@@ -0,0 +1,163 @@
+//
+//  NtpFilterTest.c
+//
+//  Author: Filippin luca
+//  luca.filippin@gmail.com
+//
+//  Known answers of the sample filters: the clock filter (register, dispersion, jitter,
+//  popcorn spikes), the huff-n'-puff correction and the median/MAD gate, worked out by hand.
+//
+//  To build on Linux (or ./makeit.sh test):
+//  gcc -O2 NtpFilterTest.c NtpFilter.c DebugUtil.c -lm -o NtpFilterTest
+//
+//  Usage: NtpFilterTest (exits with 1 on failure)
+//
+
+#include <stdio.h>
+#include <stdint.h>
+#include "NtpFilter.h"
+
+#define POLL    16000000000LL   // [ns]
+
+static int s_failed = 0;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        printf("FAILED %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+        s_failed++; \
+    } \
+} while (0)
+
+static int _add(tNtpFilter *f, int64_t offset, int64_t delay, int64_t t) {
+    tNtpSample s = { offset, delay, 0, t };
+
+    return ntp_filter_add(f, &s, POLL);
+}
+
+// One sample: the 7 empty stages weigh 16 s >> 2 .. 16 s >> 8. A second one of lower delay is used,
+// the first one aged by 1 s (15 us) weighs >> 2. A third of higher delay leaves the best one, already used.
+static void _test_filter_register() {
+    tNtpFilter f;
+
+    ntp_filter_init(&f, 1000);
+
+    CHECK(_add(&f, 5000, 100000, 1000000000LL) == 1);
+    CHECK(f.offset == 5000 && f.delay == 100000 && f.t == 1000000000LL);
+    CHECK(f.dispersion == 7937500000LL);
+    CHECK(f.jitter == 1000); // the precision
+
+    CHECK(_add(&f, 7000, 50000, 2000000000LL) == 1);
+    CHECK(f.offset == 7000 && f.delay == 50000);
+    CHECK(f.dispersion == 3750 + 3937500000LL);
+    CHECK(f.jitter == 2000);
+
+    CHECK(_add(&f, 9000, 80000, 3000000000LL) == 0);
+    CHECK(f.offset == 7000 && f.t == 2000000000LL);
+
+    CHECK(ntp_filter_dispersion(&f, 4000000000LL) == f.dispersion + 15000);
+
+    ntp_filter_slew(&f, 7000);
+    CHECK(f.offset == 0 && f.stage[0].offset == 2000 && f.stage[2].offset == -2000);
+}
+
+// A jump out of 3 jitters within 2 polls of the last sample used is a spike, it is taken once it lasts
+static void _test_filter_spike() {
+    tNtpFilter f;
+    int i;
+
+    ntp_filter_init(&f, 1000);
+    CHECK(_add(&f, 0, 100, 1000000000LL) == 1);
+
+    for (i = 1; i <= 7; i++) // the first one stays the best
+        CHECK(_add(&f, 1000000, 200, 1000000000LL + i * 1000000) == 0);
+
+    // the first one shifted out: the register agrees on 1 ms (jitter at the precision), 1 ms off the output
+    CHECK(_add(&f, 1000000, 50, 1010000000LL) == 0);
+    CHECK(f.spikes == 1 && f.offset == 0);
+
+    CHECK(_add(&f, 1000000, 40, 1000000000LL + 2 * POLL + 1) == 1);
+    CHECK(f.spikes == 1 && f.offset == 1000000);
+}
+
+// Buckets of 1 s: the minimum delay of the window is 100, the delay of 300 is 200 of queueing, of which
+// half biases the offset on the side of its sign. The minimum leaves with the window.
+static void _test_huffpuff() {
+    tNtpHuffPuff h;
+
+    ntp_huffpuff_init(&h, 8000000000LL);
+    ntp_huffpuff_add(&h, 100, 1000000000LL);
+    ntp_huffpuff_add(&h, 300, 1500000000LL);
+    CHECK(h.min_delay == 100);
+
+    CHECK(ntp_huffpuff_correct(&h, 1000, 300) == 900);
+    CHECK(ntp_huffpuff_correct(&h, -1000, 300) == -900);
+    CHECK(ntp_huffpuff_correct(&h, 1000, 50) == 1000); // below the minimum: no queueing to take out
+
+    ntp_huffpuff_add(&h, 500, 9000000000LL);
+    CHECK(h.min_delay == 500);
+
+    ntp_huffpuff_init(&h, 0); // off
+    ntp_huffpuff_add(&h, 100, 1000000000LL);
+    CHECK(ntp_huffpuff_correct(&h, 1000, 300) == 1000);
+}
+
+// History of offsets 0, 10 .. 70 and delays of 1000: median offset 35, MAD 20; median delay 1000,
+// MAD 0 raised to mad_min 10. With k = 3 the offsets within 35 +- 60 and the delays up to 1030 pass.
+static void _gate_fill(tNtpGate *g, double k) {
+    tNtpSample s = { 0, 1000, 0, 0 };
+    int i;
+
+    ntp_gate_init(g, k, 10);
+
+    for (i = 0; i < NTP_GATE_MIN; i++) {
+        s.offset = i * 10;
+        CHECK(ntp_gate_check(g, &s) == 0); // open until NTP_GATE_MIN samples
+    }
+}
+
+static void _test_gate() {
+    tNtpSample s = { 0, 1000, 0, 0 };
+    tNtpGate g;
+
+    _gate_fill(&g, 3);
+    s.offset = 95;
+    CHECK(ntp_gate_check(&g, &s) == 0);
+
+    _gate_fill(&g, 3);
+    s.offset = 96;
+    CHECK(ntp_gate_check(&g, &s) == 1);
+    CHECK(g.rejected_offset == 1 && g.rejected_delay == 0);
+
+    _gate_fill(&g, 3);
+    s.offset = 35;
+    s.delay = 1030;
+    CHECK(ntp_gate_check(&g, &s) == 0);
+
+    _gate_fill(&g, 3);
+    s.delay = 1031;
+    CHECK(ntp_gate_check(&g, &s) == 1);
+    CHECK(g.rejected_offset == 0 && g.rejected_delay == 1);
+
+    _gate_fill(&g, 0); // off
+    s.offset = 100000;
+    s.delay = 100000;
+    CHECK(ntp_gate_check(&g, &s) == 0);
+
+    // the history follows the clock: median 0 after a slew of 35
+    _gate_fill(&g, 3);
+    ntp_gate_slew(&g, 35);
+    s.offset = 61;
+    s.delay = 1000;
+    CHECK(ntp_gate_check(&g, &s) == 1);
+}
+
+int main() {
+
+    _test_filter_register();
+    _test_filter_spike();
+    _test_huffpuff();
+    _test_gate();
+
+    printf("NtpFilterTest: %s\n", s_failed ? "FAILED" : "ok");
+    return s_failed != 0;
+}
@@ -0,0 +1,93 @@
+//
+//  NtpKalman.c
+//
+//  Author: Filippin luca
+//  luca.filippin@gmail.com
+//
+
+#include <string.h>
+#include "NtpKalman.h"
+
+#define DEBUG_BASIC     0x01
+#define DEBUG_MEDIUM    0x02
+#define DEBUG_DEEP      0x04
+
+#define DEBUG_SWITCH    DEBUG_BASIC + DEBUG_MEDIUM
+#include "DebugUtil.h"
+
+#define NTPKALMAN_HEADER   "NTP-KALMAN"
+#define NTPKALMAN_DBG(fmt, ...) eprintf(NTPKALMAN_HEADER, fmt, __VA_ARGS__)
+
+#define SKEW_MAX        500000.     // 500 ppm, the NTP tolerance of the local oscillator [ns/s]
+#define Q_INIT          1.          // [(ns/s)^2/s]
+#define Q_MIN           1e-4
+#define Q_MAX           1e6
+#define NIS_AVG         16          // innovations averaging constant
+#define NIS_MAX         100         // a single innovation weighs at most as much on q
+
+#define CLAMP(a, l, h)  ((a) < (l) ? (l) : (a) > (h) ? (h) : (a))
+
+void ntp_kalman_init(tNtpKalman *k) {
+    memset(k, 0, sizeof(tNtpKalman));
+    k->q = Q_INIT;
+    k->nis = 1;
+}
+
+void ntp_kalman_prior(tNtpKalman *k, double skew, double sd) {
+    k->skew = CLAMP(skew, -SKEW_MAX, SKEW_MAX);
+    k->p[1][1] = sd * sd;
+}
+
+// Move the estimate to the local time t
+static void _predict(tNtpKalman *k, int64_t t) {
+    double dt = (double)(t - k->t) / 1e9, q = k->q;
+
+    k->offset += k->skew * dt;
+    k->p[0][0] += dt * (2 * k->p[0][1] + dt * k->p[1][1]) + q * dt * dt * dt / 3;
+    k->p[0][1] += dt * k->p[1][1] + q * dt * dt / 2;
+    k->p[1][0] = k->p[0][1];
+    k->p[1][1] += q * dt;
+    k->t = t;
+}
+
+void ntp_kalman_update(tNtpKalman *k, int64_t offset, int64_t noise, int64_t t) {
+    double r = (double)noise * noise, nu, s, k0, k1, p01, nis;
+
+    if (k->t == 0) { // the skew is only known within its prior, or the tolerance of the oscillator
+        k->offset = (double)offset;
+        k->p[0][0] = r;
+        k->p[0][1] = k->p[1][0] = 0;
+        k->p[1][1] = k->p[1][1] > 0 ? k->p[1][1] : SKEW_MAX * SKEW_MAX;
+        k->t = t;
+        k->updates++;
+        return;
+    }
+
+    if (t > k->t)
+        _predict(k, t);
+
+    nu = (double)offset - k->offset;
+    s = k->p[0][0] + r;
+    k0 = k->p[0][0] / s;
+    k1 = k->p[0][1] / s;
+
+    k->offset += k0 * nu;
+    k->skew = CLAMP(k->skew + k1 * nu, -SKEW_MAX, SKEW_MAX);
+
+    p01 = k->p[0][1];
+    k->p[1][1] -= k1 * p01;
+    k->p[0][1] = k->p[1][0] = (1 - k0) * p01;
+    k->p[0][0] *= 1 - k0;
+
+    // the process noise follows the innovations: larger than predicted, the skew wanders more than assumed
+    nis = nu * nu / s;
+    k->nis += (CLAMP(nis, 0, NIS_MAX) - k->nis) / NIS_AVG;
+    k->q = CLAMP(k->q * (k->nis > 1 ? 1 + (k->nis - 1) / NIS_AVG : 1 - (1 - k->nis) / NIS_AVG), Q_MIN, Q_MAX);
+    k->updates++;
+
+    DEBUG_LEVEL(DEBUG_DEEP, NTPKALMAN_DBG("-- Offset = %.9f, skew = %.3f ppm, innovation = %.9f (noise %.9f), q = %g, nis = %.3f\n", k->offset / 1e9, k->skew / 1000, nu / 1e9, noise / 1e9, k->q, k->nis));
+}
+
+int64_t ntp_kalman_offset(const tNtpKalman *k, int64_t t) {
+    return (int64_t)(k->offset + k->skew * (double)(t - k->t) / 1e9);
+}
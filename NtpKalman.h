@@ -0,0 +1,40 @@
+//
+//  NtpKalman.h
+//
+//  Author: Filippin luca
+//  luca.filippin@gmail.com
+//
+//  Offset and skew of the local clock estimated together by a Kalman filter. The offset drifts
+//  with the skew, the skew is a random walk whose strength (the process noise) is learned from
+//  the innovations: it grows when the measurements keep surprising the filter, and shrinks when
+//  they don't. Each measurement weighs according to its own noise, ie. the delay of the sample.
+//
+
+#ifndef __NTPKALMAN_H__
+#define __NTPKALMAN_H__
+
+#include <stdint.h>
+
+typedef struct {
+    double offset;          // at t [ns]
+    double skew;            // [ns/s]
+    double p[2][2];         // covariance of offset and skew
+    double q;               // process noise of the skew [(ns/s)^2/s]
+    double nis;             // average of the normalised innovation squared, 1 when q is right
+    int64_t t;              // local clock of the estimate, 0 before the first measurement [ns]
+    uint64_t updates;
+} tNtpKalman;
+
+void ntp_kalman_init(tNtpKalman *k);
+
+// The skew as known before the first measurement, of standard deviation sd [ns/s]: by default it is
+// only known within the tolerance of the oscillator
+void ntp_kalman_prior(tNtpKalman *k, double skew, double sd);
+
+// A measurement of the offset at the local time t, of standard deviation noise [ns]
+void ntp_kalman_update(tNtpKalman *k, int64_t offset, int64_t noise, int64_t t);
+
+// Offset predicted at the local time t [ns]
+int64_t ntp_kalman_offset(const tNtpKalman *k, int64_t t);
+
+#endif
@@ -0,0 +1,114 @@
+//
+//  NtpKalmanTest.c
+//
+//  Author: Filippin luca
+//  luca.filippin@gmail.com
+//
+//  Known answers of the Kalman discipline: the first measurement, a prior on the skew, one full
+//  predict/update step worked out by hand, the convergence on a clock of constant skew, and the
+//  adaptation of the process noise.
+//
+//  To build on Linux (or ./makeit.sh test):
+//  gcc -O2 NtpKalmanTest.c NtpKalman.c DebugUtil.c -lm -o NtpKalmanTest
+//
+//  Usage: NtpKalmanTest (exits with 1 on failure)
+//
+
+#include <stdio.h>
+#include <math.h>
+#include "NtpKalman.h"
+
+#define SEC     1000000000LL    // [ns]
+
+static int s_failed = 0;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        printf("FAILED %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+        s_failed++; \
+    } \
+} while (0)
+
+#define NEAR(a, b, tol) (fabs((double)(a) - (double)(b)) <= (tol))
+
+// The first measurement is taken as it is, the skew only known within the tolerance of the oscillator
+static void _test_first() {
+    tNtpKalman k;
+
+    ntp_kalman_init(&k);
+    CHECK(k.t == 0 && k.q == 1 && k.nis == 1);
+
+    ntp_kalman_update(&k, 1000, 100, SEC);
+    CHECK(k.offset == 1000 && k.skew == 0);
+    CHECK(k.p[0][0] == 10000 && k.p[1][1] == 500000. * 500000.);
+    CHECK(k.updates == 1);
+    CHECK(ntp_kalman_offset(&k, 2 * SEC) == 1000);
+}
+
+// A prior skew of 1 ppm carries the offset by 1000 ns/s from the first measurement; beyond the
+// tolerance of the oscillator it is clamped
+static void _test_prior() {
+    tNtpKalman k;
+
+    ntp_kalman_init(&k);
+    ntp_kalman_prior(&k, 1000, 10);
+    ntp_kalman_update(&k, 1000, 100, SEC);
+    CHECK(k.p[1][1] == 100);
+    CHECK(ntp_kalman_offset(&k, 2 * SEC) == 2000);
+
+    ntp_kalman_init(&k);
+    ntp_kalman_prior(&k, 1e6, 10);
+    CHECK(k.skew == 500000.);
+}
+
+// From offset 0 (noise 100 ns, skew 0 +- 10 ns/s), a measurement of 300 ns 1 s later. The prediction:
+// P00 = 10^4 + 100 + 1/3, P01 = 100 + 1/2, P11 = 100 + 1; S = P00 + 10^4; the gains P00 / S and P01 / S.
+static void _test_step() {
+    tNtpKalman k;
+
+    ntp_kalman_init(&k);
+    ntp_kalman_prior(&k, 0, 10);
+    ntp_kalman_update(&k, 0, 100, SEC);
+    ntp_kalman_update(&k, 300, 100, 2 * SEC);
+
+    CHECK(NEAR(k.offset, 150.748743801927, 1e-9));
+    CHECK(NEAR(k.skew, 1.4999751247906334, 1e-12));
+    CHECK(NEAR(k.p[0][0], 5024.9581267309, 1e-9));
+    CHECK(NEAR(k.p[0][1], 49.99917082635446, 1e-12) && k.p[1][0] == k.p[0][1]);
+    CHECK(NEAR(k.p[1][1], 100.49750833319514, 1e-12));
+    // normalised innovation 300^2 / S = 4.48: the average goes to 1.217, q up by its excess / 16
+    CHECK(NEAR(k.nis, 1.2173461053713868, 1e-12));
+    CHECK(NEAR(k.q, 1.0135841315857117, 1e-12));
+    CHECK(k.t == 2 * SEC && k.updates == 2);
+}
+
+// A clock 10 ppm fast, measured every second within 1 us: the skew is found within 1%, and the exact
+// measurements make the process noise shrink
+static void _test_converge() {
+    tNtpKalman k;
+    int64_t t, noise;
+    int i;
+
+    ntp_kalman_init(&k);
+
+    for (i = 1; i <= 200; i++) {
+        t = i * SEC;
+        noise = (i & 1) ? 500 : -500;
+        ntp_kalman_update(&k, 5000 + 10000 * i + noise, 1000, t);
+    }
+
+    CHECK(NEAR(k.skew, 10000, 100));
+    CHECK(NEAR(ntp_kalman_offset(&k, 201 * SEC), 5000 + 10000 * 201, 1000));
+    CHECK(k.q < 1);
+}
+
+int main() {
+
+    _test_first();
+    _test_prior();
+    _test_step();
+    _test_converge();
+
+    printf("NtpKalmanTest: %s\n", s_failed ? "FAILED" : "ok");
+    return s_failed != 0;
+}
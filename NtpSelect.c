@@ -0,0 +1,178 @@
+//
+//  NtpSelect.c
+//
+//  Author: Filippin luca
+//  luca.filippin@gmail.com
+//
+
+#include <stdlib.h>
+#include <math.h>
+#include "NtpSelect.h"
+
+#define DEBUG_BASIC     0x01
+#define DEBUG_MEDIUM    0x02
+#define DEBUG_DEEP      0x04
+
+#define DEBUG_SWITCH    DEBUG_BASIC + DEBUG_MEDIUM
+#include "DebugUtil.h"
+
+#define NTPSELECT_HEADER   "NTP-SELECT"
+#define NTPSELECT_DBG(fmt, ...) eprintf(NTPSELECT_HEADER, fmt, __VA_ARGS__)
+
+#define NTP_SELECT_MAX  64
+
+typedef struct {
+    int64_t val;
+    int type;               // -1 low end of an interval, 0 midpoint, +1 high end
+} tEndpoint;
+
+static int _endpoint_cmp(const void *a, const void *b) {
+    const tEndpoint *x = (const tEndpoint *)a, *y = (const tEndpoint *)b;
+
+    if (x->val != y->val)
+        return x->val < y->val ? -1 : 1;
+    return x->type - y->type;
+}
+
+// Candidates are sorted by this: lower is better
+#define METRIC(c)   ((int64_t)(c)->stratum * NTP_SELECT_MAXDIST + (c)->distance)
+
+int ntp_select(tNtpCandidate *c, int n) {
+    tEndpoint e[3 * NTP_SELECT_MAX];
+    int64_t low = 0, high = 0;
+    int i, allow, found, chime, m = 0, k = 0, survivors = 0;
+
+    n = n > NTP_SELECT_MAX ? NTP_SELECT_MAX : n;
+
+    // too far to be of any use
+    for (i = 0; i < n; i++) {
+        c[i].survivor = 0;
+
+        if (c[i].distance >= NTP_SELECT_MAXDIST)
+            continue;
+
+        k++;
+        e[m].val = c[i].offset - c[i].distance; e[m++].type = -1;
+        e[m].val = c[i].offset; e[m++].type = 0;
+        e[m].val = c[i].offset + c[i].distance; e[m++].type = +1;
+    }
+    qsort(e, m, sizeof(tEndpoint), _endpoint_cmp);
+
+    // Find the largest intersection of correctness intervals shared by n - allow candidates,
+    // allowing up to allow falsetickers, whose midpoints have to lay outside of it
+    for (allow = 0; 2 * allow < k; allow++) {
+        low = INT64_MAX;
+        high = INT64_MIN;
+        found = 0;
+
+        for (chime = 0, i = 0; i < m; i++) {
+            chime -= e[i].type;
+            if (chime >= k - allow) {
+                low = e[i].val;
+                break;
+            }
+            found += e[i].type == 0;
+        }
+
+        for (chime = 0, i = m - 1; i >= 0; i--) {
+            chime += e[i].type;
+            if (chime >= k - allow) {
+                high = e[i].val;
+                break;
+            }
+            found += e[i].type == 0;
+        }
+
+        if (found <= allow && low <= high)
+            break;
+    }
+
+    if (2 * allow >= k) {
+        DEBUG_LEVEL(DEBUG_BASIC, NTPSELECT_DBG("-- No majority among %d candidates\n", n));
+        return 0;
+    }
+
+    // the truechimers are the candidates whose interval meets the intersection
+    for (i = 0; i < n; i++) {
+        if (c[i].distance < NTP_SELECT_MAXDIST && c[i].offset + c[i].distance >= low && c[i].offset - c[i].distance <= high) {
+            c[i].survivor = 1;
+            survivors++;
+        }
+    }
+
+    DEBUG_LEVEL(DEBUG_MEDIUM, NTPSELECT_DBG("-- Intersection [%.9f, %.9f]: %d truechimers out of %d\n", low / 1e9, high / 1e9, survivors, n));
+    return survivors;
+}
+
+int ntp_cluster(tNtpCandidate *c, int n) {
+    int i, j, worst, survivors = 0;
+    double phi, phi_max, jitter_min, d;
+
+    for (i = 0; i < n; i++)
+        survivors += c[i].survivor;
+
+    while (survivors > NTP_SELECT_NMIN) {
+        worst = -1;
+        phi_max = 0;
+        jitter_min = -1;
+
+        for (i = 0; i < n; i++) {
+            if (!c[i].survivor)
+                continue;
+
+            // selection jitter: how far the others are from this one
+            for (phi = 0, j = 0; j < n; j++) {
+                if (c[j].survivor) {
+                    d = (double)(c[i].offset - c[j].offset);
+                    phi += d * d;
+                }
+            }
+            phi = sqrt(phi / (survivors - 1));
+
+            if (worst < 0 || phi > phi_max) {
+                phi_max = phi;
+                worst = i;
+            }
+
+            if (jitter_min < 0 || c[i].jitter < jitter_min)
+                jitter_min = (double)c[i].jitter;
+        }
+
+        if (phi_max <= jitter_min)
+            break;
+
+        DEBUG_LEVEL(DEBUG_MEDIUM, NTPSELECT_DBG("-- Outlier %d dropped: offset = %.9f, selection jitter = %.9f\n", worst, c[worst].offset / 1e9, phi_max / 1e9));
+        c[worst].survivor = 0;
+        survivors--;
+    }
+    return survivors;
+}
+
+int ntp_combine(tNtpCandidate *c, int n, int64_t *pOffset, int64_t *pJitter) {
+    double w, sum_w = 0, sum_ofs = 0, sum_jit = 0, d;
+    int i, sys = -1;
+
+    for (i = 0; i < n; i++) {
+        if (c[i].survivor && (sys < 0 || METRIC(&c[i]) < METRIC(&c[sys])))
+            sys = i;
+    }
+
+    if (sys < 0)
+        return -1;
+
+    for (i = 0; i < n; i++) {
+        if (!c[i].survivor)
+            continue;
+
+        w = 1.0 / (double)(c[i].distance > 0 ? c[i].distance : 1);
+        d = (double)(c[i].offset - c[sys].offset);
+        sum_w += w;
+        sum_ofs += w * (double)c[i].offset;
+        sum_jit += w * d * d;
+    }
+
+    *pOffset = (int64_t)(sum_ofs / sum_w);
+    // the system jitter adds up the jitter of the system peer and the one among the survivors
+    *pJitter = (int64_t)sqrt((double)c[sys].jitter * c[sys].jitter + sum_jit / sum_w);
+    return sys;
+}
@@ -0,0 +1,41 @@
+//
+//  NtpSelect.h
+//
+//  Author: Filippin luca
+//  luca.filippin@gmail.com
+//
+//  The mitigation algorithms of rfc5905 (appendix A.5.5): out of the offsets measured against
+//  several servers, select the truechimers, cluster them dropping the outliers and combine
+//  the survivors into the system offset.
+//
+
+#ifndef __NTPSELECT_H__
+#define __NTPSELECT_H__
+
+#include <stdint.h>
+
+#define NTP_SELECT_MINDISP      10000000LL      // minimum dispersion [ns]
+#define NTP_SELECT_MAXDIST      1000000000LL    // distance threshold [ns]
+#define NTP_SELECT_NMIN         3               // minimum survivors of the clustering
+
+typedef struct {
+    int64_t offset;         // [ns]
+    int64_t distance;       // root distance: half the correctness interval [ns]
+    int64_t jitter;         // [ns]
+    int stratum;
+    int survivor;           // set by ntp_select, cleared by ntp_cluster
+} tNtpCandidate;
+
+// Intersection algorithm: survivor is set on the truechimers. Returns their number, 0 if no
+// majority of the candidates agrees.
+int ntp_select(tNtpCandidate *c, int n);
+
+// Cluster algorithm: drop the survivors farthest from the others until their jitter is below
+// the jitter of the best one, or NTP_SELECT_NMIN are left. Returns the survivors left.
+int ntp_cluster(tNtpCandidate *c, int n);
+
+// Combine algorithm: the survivor offsets weighted by 1 / distance. Returns the system peer
+// (the survivor of lowest stratum and distance), -1 if there are no survivors.
+int ntp_combine(tNtpCandidate *c, int n, int64_t *pOffset, int64_t *pJitter);
+
+#endif
@@ -0,0 +1,133 @@
+//
+//  NtpSelectTest.c
+//
+//  Author: Filippin luca
+//  luca.filippin@gmail.com
+//
+//  Known answers of the mitigation algorithms: intersection, clustering and combination
+//  of the offsets of a few servers, worked out by hand.
+//
+//  To build on Linux (or ./makeit.sh test):
+//  gcc -O2 NtpSelectTest.c NtpSelect.c DebugUtil.c -lm -o NtpSelectTest
+//
+//  Usage: NtpSelectTest (exits with 1 on failure)
+//
+
+#include <stdio.h>
+#include <string.h>
+#include "NtpSelect.h"
+
+static int s_failed = 0;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        printf("FAILED %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+        s_failed++; \
+    } \
+} while (0)
+
+static void _candidate(tNtpCandidate *c, int64_t offset, int64_t distance, int64_t jitter, int stratum) {
+    memset(c, 0, sizeof(tNtpCandidate));
+    c->offset = offset;
+    c->distance = distance;
+    c->jitter = jitter;
+    c->stratum = stratum;
+}
+
+// [-10, 10] and [-5, 15] intersect, [90, 110] is a falseticker
+static void _test_select_falseticker() {
+    tNtpCandidate c[3];
+
+    _candidate(&c[0], 0, 10, 1, 1);
+    _candidate(&c[1], 5, 10, 1, 1);
+    _candidate(&c[2], 100, 10, 1, 1);
+
+    CHECK(ntp_select(c, 3) == 2);
+    CHECK(c[0].survivor && c[1].survivor && !c[2].survivor);
+}
+
+// Two disjoint intervals: no majority
+static void _test_select_no_majority() {
+    tNtpCandidate c[2];
+
+    _candidate(&c[0], 0, 10, 1, 1);
+    _candidate(&c[1], 100, 10, 1, 1);
+
+    CHECK(ntp_select(c, 2) == 0);
+    CHECK(!c[0].survivor && !c[1].survivor);
+}
+
+// A candidate beyond the distance threshold takes no part, nor survives
+static void _test_select_too_far() {
+    tNtpCandidate c[3];
+
+    _candidate(&c[0], 0, 10, 1, 1);
+    _candidate(&c[1], 5, 10, 1, 1);
+    _candidate(&c[2], 3, NTP_SELECT_MAXDIST, 1, 1);
+
+    CHECK(ntp_select(c, 3) == 2);
+    CHECK(c[0].survivor && c[1].survivor && !c[2].survivor);
+}
+
+// 0, 10, 20, 1000: the last is the farthest from the others (selection jitter 990) and goes,
+// then NTP_SELECT_NMIN are left
+static void _test_cluster_outlier() {
+    tNtpCandidate c[4];
+    int i;
+
+    _candidate(&c[0], 0, 10, 1, 1);
+    _candidate(&c[1], 10, 10, 1, 1);
+    _candidate(&c[2], 20, 10, 1, 1);
+    _candidate(&c[3], 1000, 10, 1, 1);
+
+    for (i = 0; i < 4; i++)
+        c[i].survivor = 1;
+
+    CHECK(ntp_cluster(c, 4) == 3);
+    CHECK(c[0].survivor && c[1].survivor && c[2].survivor && !c[3].survivor);
+}
+
+// 0, 10, 20, 30: the largest selection jitter (21.6) is within the jitter of the best one (100)
+static void _test_cluster_within_jitter() {
+    tNtpCandidate c[4];
+    int i;
+
+    for (i = 0; i < 4; i++) {
+        _candidate(&c[i], i * 10, 10, 100, 1);
+        c[i].survivor = 1;
+    }
+
+    CHECK(ntp_cluster(c, 4) == 4);
+}
+
+// Weights 1/8 and 1/32: (100/8 + 200/32) / (1/8 + 1/32) = 120. The system peer is the one of lower
+// stratum, its jitter sqrt(7^2 + (100^2/8) / (1/8 + 1/32)) = sqrt(8049) = 89.7
+static void _test_combine() {
+    tNtpCandidate c[3];
+    int64_t offset = 0, jitter = 0;
+
+    _candidate(&c[0], 100, 8, 5, 2);
+    _candidate(&c[1], 200, 32, 7, 1);
+    _candidate(&c[2], 5000, 1, 1, 1); // not a survivor
+    c[0].survivor = c[1].survivor = 1;
+
+    CHECK(ntp_combine(c, 3, &offset, &jitter) == 1);
+    CHECK(offset == 120);
+    CHECK(jitter == 89);
+
+    c[0].survivor = c[1].survivor = 0;
+    CHECK(ntp_combine(c, 3, &offset, &jitter) == -1);
+}
+
+int main() {
+
+    _test_select_falseticker();
+    _test_select_no_majority();
+    _test_select_too_far();
+    _test_cluster_outlier();
+    _test_cluster_within_jitter();
+    _test_combine();
+
+    printf("NtpSelectTest: %s\n", s_failed ? "FAILED" : "ok");
+    return s_failed != 0;
+}
@@ -0,0 +1,157 @@
+//
+//  NtpState.c
+//
+//  Author: Filippin luca
+//  luca.filippin@gmail.com
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "NtpState.h"
+
+#define DEBUG_BASIC     0x01
+#define DEBUG_MEDIUM    0x02
+#define DEBUG_DEEP      0x04
+
+#define DEBUG_SWITCH    DEBUG_BASIC + DEBUG_MEDIUM
+#include "DebugUtil.h"
+
+#define NTPSTATE_HEADER   "NTP-STATE"
+#define NTPSTATE_DBG(fmt, ...) eprintf(NTPSTATE_HEADER, fmt, __VA_ARGS__)
+
+#define BOOT_ID_FILE    "/proc/sys/kernel/random/boot_id"
+
+// CLOCK_BOOTTIME, which counts the suspensions too, or -1 where there is none [ns]
+static int64_t _boottime() {
+#ifdef CLOCK_BOOTTIME
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_BOOTTIME, &ts) == 0)
+        return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+#endif
+    return -1;
+}
+
+// Identity of the kernel run, empty where there is none: CLOCK_BOOTTIME alone cannot tell a
+// reboot from a longer uptime
+static void _boot_id(char *id) {
+    int fd = open(BOOT_ID_FILE, O_RDONLY);
+    ssize_t n = 0;
+
+    memset(id, 0, NTP_STATE_BOOT_ID);
+
+    if (fd >= 0) {
+        n = read(fd, id, NTP_STATE_BOOT_ID - 1);
+        close(fd);
+    }
+
+    id[n > 0 && id[n - 1] == '\n' ? n - 1 : 0] = 0;
+}
+
+// FNV-1a, over the checksum as 0
+static uint32_t _checksum(const tNtpState *s) {
+    const uint8_t *p = (const uint8_t *)s;
+    size_t i, c = offsetof(tNtpState, checksum);
+    uint32_t h = 2166136261U;
+
+    for (i = 0; i < sizeof(tNtpState); i++)
+        h = (h ^ (i >= c && i < c + sizeof(s->checksum) ? 0 : p[i])) * 16777619U;
+
+    return h;
+}
+
+// Make the rename of a file in the directory of path durable
+static void _sync_dir(const char *path) {
+    char dir[PATH_MAX];
+    const char *slash = strrchr(path, '/');
+    int fd;
+
+    if (slash == NULL)
+        strcpy(dir, ".");
+    else if (slash == path)
+        strcpy(dir, "/");
+    else
+        snprintf(dir, sizeof(dir), "%.*s", (int)(slash - path), path);
+
+    if ((fd = open(dir, O_RDONLY)) >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+}
+
+// Written to a temporary file of its own, synced, then renamed over the previous state: a crash leaves
+// either of the two whole, and the instances sharing the file do not write into each other's
+int ntp_state_save(const char *path, tNtpState *s) {
+    char tmp[PATH_MAX];
+    int fd, ret;
+
+    if ((s->boottime = _boottime()) < 0)
+        return 1;
+
+    s->magic = NTP_STATE_MAGIC;
+    s->version = NTP_STATE_VERSION;
+    s->size = sizeof(tNtpState);
+    _boot_id(s->boot_id);
+    s->checksum = _checksum(s);
+
+    if (snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path) >= (int)sizeof(tmp))
+        return 1;
+
+    if ((fd = mkstemp(tmp)) < 0) {
+        DEBUG_LEVEL(DEBUG_BASIC, NTPSTATE_DBG("-- Can't write the state to %s\n", path));
+        return 1;
+    }
+
+    ret = fchmod(fd, 0644) != 0; // mkstemp creates it 0600
+    ret |= write(fd, s, sizeof(tNtpState)) != sizeof(tNtpState);
+    ret |= fsync(fd) != 0;
+    ret |= close(fd) != 0;
+
+    if (ret || rename(tmp, path) != 0) {
+        DEBUG_LEVEL(DEBUG_BASIC, NTPSTATE_DBG("-- Can't replace the state %s\n", path));
+        unlink(tmp);
+        return 1;
+    }
+
+    _sync_dir(path);
+
+    DEBUG_LEVEL(DEBUG_DEEP, NTPSTATE_DBG("-- State saved to %s: freq = %.3f ppm, poll = %.3f\n", path, s->freq * 1e6 / 4294967296., s->poll / 1e9));
+    return 0;
+}
+
+int ntp_state_load(const char *path, tNtpState *s, int64_t *pElapsed) {
+    char boot_id[NTP_STATE_BOOT_ID];
+    int64_t now = _boottime();
+    int fd, n;
+
+    if ((fd = open(path, O_RDONLY)) < 0)
+        return 1;
+
+    n = (int)read(fd, s, sizeof(tNtpState));
+    close(fd);
+
+    if (n != sizeof(tNtpState) || s->magic != NTP_STATE_MAGIC || s->version != NTP_STATE_VERSION || s->size != sizeof(tNtpState) || s->checksum != _checksum(s)) {
+        DEBUG_LEVEL(DEBUG_BASIC, NTPSTATE_DBG("-- The state %s is damaged or of another version\n", path));
+        return 1;
+    }
+
+    _boot_id(boot_id);
+
+    if (now < 0 || now < s->boottime || strncmp(boot_id, s->boot_id, NTP_STATE_BOOT_ID) != 0) {
+        DEBUG_LEVEL(DEBUG_MEDIUM, NTPSTATE_DBG("-- The state %s was saved before a reboot\n", path));
+        return 1;
+    }
+
+    if (s->n_peers < 0 || s->n_peers > NTP_STATE_PEERS)
+        return 1;
+
+    *pElapsed = now - s->boottime;
+    return 0;
+}
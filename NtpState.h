@@ -0,0 +1,56 @@
+//
+//  NtpState.h
+//
+//  Author: Filippin luca
+//  luca.filippin@gmail.com
+//
+//  What the synchronisation learned, kept in a small binary file across the restarts of the
+//  process: the frequency of the local clock, the time it kept and the quality of the servers.
+//  The file is replaced atomically, and is only good within the kernel run it was saved in:
+//  the elapsed CLOCK_BOOTTIME tells how old it is.
+//
+
+#ifndef __NTPSTATE_H__
+#define __NTPSTATE_H__
+
+#include <stdint.h>
+
+#define NTP_STATE_MAGIC     0x5753544EU     // "NTSW"
+#define NTP_STATE_VERSION   1
+#define NTP_STATE_PEERS     8
+#define NTP_STATE_HOST      256
+#define NTP_STATE_BOOT_ID   40
+
+typedef struct {
+    char host[NTP_STATE_HOST];
+    int32_t port;
+    int64_t min_delay;      // baseline of the round trip [ns]
+    int64_t jitter;         // [ns]
+} tNtpStatePeer;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;
+    uint32_t checksum;      // of the whole state, with this field 0
+    char boot_id[NTP_STATE_BOOT_ID]; // of the kernel run it was saved in
+    int64_t boottime;       // CLOCK_BOOTTIME when saved [ns]
+
+    int64_t local;          // local clock when saved [ns]
+    int64_t time;           // the synchronised time then [unix ns]
+    int64_t freq;           // frequency correction of the local clock, signed 32.32 fixed point [ns/ns]
+    int64_t wander;         // RMS of the steps of freq, signed 32.32 fixed point [ns/ns]
+    int64_t poll;           // interval of the clock updates [ns]
+    int32_t n_peers;
+    tNtpStatePeer peers[NTP_STATE_PEERS];
+} tNtpState;
+
+// Write s to path through a temporary file renamed over it, so that a reader never finds it half
+// written: the header, the boot id and the boottime are filled in here. 0 on success.
+int ntp_state_save(const char *path, tNtpState *s);
+
+// Read the state saved to path: 0 if it is there, intact, and saved within this kernel run, with
+// *pElapsed the CLOCK_BOOTTIME elapsed since [ns]; 1 if not.
+int ntp_state_load(const char *path, tNtpState *s, int64_t *pElapsed);
+
+#endif
@@ -0,0 +1,183 @@
+//
+//  NtpStateTest.c
+//
+//  Author: Filippin luca
+//  luca.filippin@gmail.com
+//
+//  Known answers of the warm start state file: the round trip, the checksum (against a
+//  reference FNV-1a), and the rejection of a damaged file, of another version, of another
+//  kernel run and of a boottime from the future.
+//
+//  To build on Linux (or ./makeit.sh test):
+//  gcc -O2 NtpStateTest.c NtpState.c DebugUtil.c -o NtpStateTest
+//
+//  Usage: NtpStateTest (exits with 1 on failure)
+//
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <dirent.h>
+#include "NtpState.h"
+
+static int s_failed = 0;
+static char s_path[64];
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        printf("FAILED %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+        s_failed++; \
+    } \
+} while (0)
+
+static uint32_t _fnv1a(const uint8_t *p, size_t n) {
+    uint32_t h = 2166136261U;
+    size_t i;
+
+    for (i = 0; i < n; i++)
+        h = (h ^ p[i]) * 16777619U;
+    return h;
+}
+
+// What the file should carry: FNV-1a of the state with the checksum 0
+static uint32_t _checksum(const tNtpState *s) {
+    tNtpState c = *s;
+
+    c.checksum = 0;
+    return _fnv1a((const uint8_t *)&c, sizeof(tNtpState));
+}
+
+static int _read(tNtpState *s) {
+    FILE *f = fopen(s_path, "rb");
+    int rc = f != NULL && fread(s, sizeof(tNtpState), 1, f) == 1;
+
+    if (f != NULL)
+        fclose(f);
+    return rc;
+}
+
+static void _write(const tNtpState *s) {
+    FILE *f = fopen(s_path, "wb");
+
+    CHECK(f != NULL && fwrite(s, sizeof(tNtpState), 1, f) == 1);
+    if (f != NULL)
+        fclose(f);
+}
+
+static int _files(const char *dir) {
+    DIR *d = opendir(dir);
+    struct dirent *e;
+    int n = 0;
+
+    while (d != NULL && (e = readdir(d)) != NULL)
+        n += e->d_name[0] != '.';
+    if (d != NULL)
+        closedir(d);
+    return n;
+}
+
+static void _state(tNtpState *s) {
+    memset(s, 0, sizeof(tNtpState));
+    s->local = 123456789;
+    s->time = 1700000000000000000LL;
+    s->freq = -42949673;    // -10 ppm
+    s->wander = 429497;
+    s->poll = 64000000000LL;
+    s->n_peers = 1;
+    strcpy(s->peers[0].host, "10.0.0.1");
+    s->peers[0].port = 123;
+    s->peers[0].min_delay = 150000;
+    s->peers[0].jitter = 2000;
+}
+
+static void _test_fnv1a() {
+    CHECK(_fnv1a((const uint8_t *)"", 0) == 0x811c9dc5U);
+    CHECK(_fnv1a((const uint8_t *)"a", 1) == 0xe40c292cU);
+    CHECK(_fnv1a((const uint8_t *)"foobar", 6) == 0xbf9cf968U);
+}
+
+static void _test_round_trip(const char *dir) {
+    tNtpState s, r, f;
+    int64_t elapsed = -1;
+
+    _state(&s);
+    CHECK(ntp_state_save(s_path, &s) == 0);
+    CHECK(_files(dir) == 1); // no temporary left behind
+
+    CHECK(_read(&f));
+    CHECK(f.magic == NTP_STATE_MAGIC && f.version == NTP_STATE_VERSION && f.size == sizeof(tNtpState));
+    CHECK(f.checksum == _checksum(&f));
+
+    usleep(10000);
+    CHECK(ntp_state_load(s_path, &r, &elapsed) == 0);
+    CHECK(memcmp(&r, &f, sizeof(tNtpState)) == 0);
+    CHECK(elapsed >= 10000000 && elapsed < 1000000000);
+    CHECK(r.freq == -42949673 && r.poll == 64000000000LL && r.n_peers == 1 && strcmp(r.peers[0].host, "10.0.0.1") == 0);
+}
+
+static void _test_rejected() {
+    tNtpState f, r;
+    int64_t elapsed;
+    char id;
+
+    _state(&f);
+    CHECK(ntp_state_save(s_path, &f) == 0);
+    CHECK(_read(&f));
+
+    // a bit flipped
+    f.poll ^= 1;
+    _write(&f);
+    CHECK(ntp_state_load(s_path, &r, &elapsed) == 1);
+    f.poll ^= 1;
+
+    // another version, consistent
+    f.version++;
+    f.checksum = _checksum(&f);
+    _write(&f);
+    CHECK(ntp_state_load(s_path, &r, &elapsed) == 1);
+    f.version--;
+
+    // saved in another kernel run
+    id = f.boot_id[0];
+    f.boot_id[0] = id == '0' ? '1' : '0';
+    f.checksum = _checksum(&f);
+    _write(&f);
+    CHECK(ntp_state_load(s_path, &r, &elapsed) == 1);
+    f.boot_id[0] = id;
+
+    // in this one, but after now: the boottime alone tells a reboot where there is no boot id
+    f.boottime += 3600 * 1000000000LL;
+    f.checksum = _checksum(&f);
+    _write(&f);
+    CHECK(ntp_state_load(s_path, &r, &elapsed) == 1);
+
+    // short
+    CHECK(truncate(s_path, sizeof(tNtpState) / 2) == 0);
+    CHECK(ntp_state_load(s_path, &r, &elapsed) == 1);
+
+    unlink(s_path);
+    CHECK(ntp_state_load(s_path, &r, &elapsed) == 1);
+}
+
+int main() {
+    char dir[] = "/tmp/ntpstate.XXXXXX";
+
+    if (mkdtemp(dir) == NULL) {
+        printf("%s\n", "Cannot create the test directory");
+        return 1;
+    }
+    snprintf(s_path, sizeof(s_path), "%s/state", dir);
+
+    _test_fnv1a();
+    _test_round_trip(dir);
+    _test_rejected();
+
+    unlink(s_path);
+    rmdir(dir);
+
+    printf("NtpStateTest: %s\n", s_failed ? "FAILED" : "ok");
+    return s_failed != 0;
+}
@@ -19,12 +19,27 @@
 
 #include <sys/time.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <pthread.h>
 #include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <sys/stat.h>
 #include "ByteOrder.h"
 #include "UdpConn.h"
+#include "TscClock.h"
+#include "NtpSyncPage.h"
 #include "NtpSync.h"
+#include "NtpSyncFast.h"
+#include "NtpFilter.h"
+#include "NtpSelect.h"
+#include "NtpKalman.h"
+#include "NtpState.h"
 
 #define DEBUG_BASIC     0x01
 #define DEBUG_MEDIUM    0x02
@@ -41,12 +56,16 @@
 #ifdef __APPLE__
     #include <Carbon/Carbon.h>
     #include <CoreAudio/CoreAudio.h>
-    #define GETSECS() (((double)UnsignedWideToUInt64(AbsoluteToNanoseconds(UpTime()))) / 1e9)
+    #define GETNSECS() ((int64_t)UnsignedWideToUInt64(AbsoluteToNanoseconds(UpTime())))
 #endif
 
 #ifdef __linux__
     #include <time.h>
     #include <assert.h>
+    #include <poll.h>
+    #include <sys/epoll.h>
+    #include <sys/timerfd.h>
+    #include <sys/eventfd.h>
 
     #ifdef CLOCK_MONOTONIC_RAW
         #define _CLOCK_TYPE CLOCK_MONOTONIC_RAW
@@ -54,13 +73,19 @@
         #define _CLOCK_TYPE CLOCK_MONOTONIC
     #endif
 
-    #define GETSECS() ({ \
+    #define GETNSECS() ({ \
         struct timespec tp; \
         clock_gettime(_CLOCK_TYPE, &tp); \
-        (double)tp.tv_sec + (double)tp.tv_nsec/1e9; \
+        (int64_t)tp.tv_sec * NSECS_PER_SEC + tp.tv_nsec; \
     })
 #endif
 
+#define NSECS_PER_SEC   1000000000LL
+
+static int64_t _getnsecs() {
+    return GETNSECS();
+}
+
 //----- NTP synchronisation (based on rfc5905)
 
 // NTP macros
@@ -106,7 +131,7 @@ typedef struct {
     #undef MIN
 #endif
 
-#define TWO_E32             0x100000000L
+#define TWO_E32             0x100000000LL
 #define TWO_E16             0x10000L
 #define MAX(a,b)            ((a) < (b) ? (b) : (a))
 #define MIN(a,b)            ((a) < (b) ? (a) : (b))
@@ -116,7 +141,10 @@ typedef struct {
 #define	D2FP(a)             ((tdist)((a) * TWO_E16))
 #define LFP2D(a)            ((double)(a) / TWO_E32)
 #define D2LFP(a)            ((tstamp)((a) * TWO_E32))
-#define U2LFP(a)            (((unsigned long long)((a).tv_sec + JAN_1970) << 32) + (unsigned long long)((a).tv_usec / 1e6 * TWO_E32))
+#define U2LFP(a)            (((unsigned long long)((a).tv_sec + JAN_1970) << 32) + ((unsigned long long)(a).tv_usec << 32) / 1000000)
+#define NS2D(a)             ((double)(a) / NSECS_PER_SEC)
+#define NS2LFP(a)           ((tstamp)(((a) / NSECS_PER_SEC) * TWO_E32 + ((a) % NSECS_PER_SEC) * TWO_E32 / NSECS_PER_SEC))
+#define LFP2NS(a)           ((int64_t)(((a) / TWO_E32) * NSECS_PER_SEC + ((a) % TWO_E32) * NSECS_PER_SEC / TWO_E32))
 #define LFP70(a)            ((uint64_t)(a) - ((uint64_t)JAN_1970 << 32))
 #define LFP00(a)            ((uint64_t)(a) + ((uint64_t)JAN_1970 << 32))
 
@@ -137,57 +165,279 @@ typedef struct {
 
 #define NTP_PACKET_SIZE     sizeof(tNtpPkt)
 
+// All the time quantities are integer nanoseconds: a double holding the Unix time only resolves ~0.2 us
 typedef struct {
     tstamp tzero_ntp_wck;   // remote ntp timestamp in ntp format
-    double tzero_wck;       // remote ntp timestamp
-    double tzero_sys;       // local system clock
-    double tsync_sys;       // local system clock
-    double offset;          // absolute offset (incremented abrupbtely of ofs_rel)
-    double slewed_offset;   // absolute slewed offset (slowly increased to cover the gap of ofs_rel)
-    double delay;           // RTT value for the correspondent ofs_rel one
-    double ofs_rel;         // relative offset (intra adjustments)
-    double ofs_rel_max;     // after the first ajustement
-    double ofs_rel_min;     // after the first ajustement
+    int64_t tzero_wck;      // remote ntp timestamp [unix ns]
+    int64_t tzero_sys;      // local system clock [ns]
+    int64_t offset;         // absolute offset (incremented abrupbtely of ofs_rel)
+    tNtpSyncSlew slew;      // how offset is reached after an adjustement (read path formula)
+    int64_t tsync_sys;      // local system clock [ns], the origin of the frequency correction
+    int64_t freq;           // local clock frequency correction, signed 32.32 fixed point [ns/ns]
+    int64_t wander;         // RMS of the steps of freq, signed 32.32 fixed point [ns/ns]
+    int64_t delay;          // RTT value for the correspondent ofs_rel one
+    int64_t ofs_rel;        // relative offset (intra adjustments)
+    int64_t ofs_rel_max;    // after the first ajustement
+    int64_t ofs_rel_min;    // after the first ajustement
     int adjustements;
+    tTscClock tsc;          // local clock source, when valid
+    int64_t coarse_ofs;     // local clock - coarse clock, at the middle of a coarse tick [ns]
+    int64_t coarse_res;     // coarse clock resolution [ns]
+    int64_t coarse_err;     // coarse clock error bound [ns]
+    int64_t coarse_rate;    // drift of coarse_ofs, signed 32.32 fixed point [ns/ns]
+    int64_t coarse_t;       // local clock of the coarse clock measurement [ns]
 } tTime;
 
-#define LOC_OFS(t, now)         ((now) - (t)->tzero_sys + (t)->offset)
+// The local clock is read once per conversion: now may be an expression like GETNSECS()
+#define FREQ_OFS(t, now)        ntp_sync_mul_q32((now) - (t)->tsync_sys, (t)->freq)
+#define LOC_OFS(t, now)         ({ int64_t _n = (now); _n - (t)->tzero_sys + (t)->offset + FREQ_OFS(t, _n); })
 #define LOC_2_UNIX(t, l)        ((t)->tzero_wck + LOC_OFS(t, l))
-#define LOC_2_NTP(t, l)         ((t)->tzero_ntp_wck + D2LFP(LOC_OFS(t, l)))
-#define UNIX_TIME(t)            LOC_2_UNIX(t, GETSECS())
-#define NTP_TIME(t)             LOC_2_NTP(t, GETSECS())
+#define LOC_2_NTP(t, l)         ((t)->tzero_ntp_wck + NS2LFP(LOC_OFS(t, l)))
+#define UNIX_TIME(t)            LOC_2_UNIX(t, GETNSECS())
+#define NTP_TIME(t)             LOC_2_NTP(t, GETNSECS())
 
-#define SLEWED_LOC_OFS(t, now)  ((now) - (t)->tzero_sys + (t)->slewed_offset)
+#define SLEWED_OFS(t, now)      ntp_sync_slew_offset(&(t)->slew, (t)->offset, now)
+#define SLEWED_LOC_OFS(t, now)  ({ int64_t _n = (now); _n - (t)->tzero_sys + SLEWED_OFS(t, _n) + FREQ_OFS(t, _n); })
 #define SLEWED_LOC_2_UNIX(t, l) ((t)->tzero_wck + SLEWED_LOC_OFS(t, l))
-#define SLEWED_LOC_2_NTP(t, l)  ((t)->tzero_ntp_wck + D2LFP(SLEWED_LOC_OFS(t, l)))
-#define SLEWED_UNIX_TIME(t)     SLEWED_LOC_2_UNIX(t, GETSECS())
-#define SLEWED_NTP_TIME(t)      SLEWED_LOC_2_NTP(t, GETSECS())
+#define SLEWED_LOC_2_NTP(t, l)  ((t)->tzero_ntp_wck + NS2LFP(SLEWED_LOC_OFS(t, l)))
+#define SLEWED_UNIX_TIME(t)     SLEWED_LOC_2_UNIX(t, GETNSECS())
+#define SLEWED_NTP_TIME(t)      SLEWED_LOC_2_NTP(t, GETNSECS())
+
+// Readers take the local clock from the timebase: field names of tNtpSyncTimebase match tTime,
+// so that the SLEWED_* macros apply to both.
+#define TB_NSECS(tb)    ntp_sync_page_local_ns(tb)
+
+static void _clock_publish(tNtpSyncPage *pPage, tTime *pT) {
+    uint32_t seq = pPage->seq;
+
+    __atomic_store_n(&pPage->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    pPage->tb.tzero_ntp_wck = pT->tzero_ntp_wck;
+    pPage->tb.tzero_wck = pT->tzero_wck;
+    pPage->tb.tzero_sys = pT->tzero_sys;
+    pPage->tb.offset = pT->offset;
+    pPage->tb.slew = pT->slew;
+    pPage->tb.tsync_sys = pT->tsync_sys;
+    pPage->tb.freq = pT->freq;
+    pPage->tb.tsc = pT->tsc.scale;
+    pPage->tb.use_tsc = pT->tsc.valid;
+    pPage->tb.coarse_ofs = pT->coarse_ofs;
+    pPage->tb.coarse_res = pT->coarse_res;
+    pPage->tb.coarse_err = pT->coarse_err;
+    pPage->tb.coarse_rate = pT->coarse_rate;
+    pPage->tb.coarse_t = pT->coarse_t;
+    __atomic_store_n(&pPage->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+static void _clock_synchronised(tNtpSyncPage *pPage, int synchronised) {
+    __atomic_store_n(&pPage->synchronised, synchronised, __ATOMIC_RELEASE);
+}
+
+static uint32_t s_page_seq = 0;
+
+static void _page_init(tNtpSyncPage *pPage) {
+
+    // a new page: its sequence starts far from the one of any page that was at the same address before,
+    // so that the timebase a reader thread cached from that one doesn't look current
+    if (pPage->seq == 0)
+        pPage->seq = __atomic_add_fetch(&s_page_seq, 1 << 16, __ATOMIC_RELAXED);
+
+    pPage->version = NTPSYNC_PAGE_VERSION;
+    pPage->size = sizeof(tNtpSyncPage);
+    pPage->synchronised = 0;
+    pPage->seq += pPage->seq & 1; // a previous writer may have died halfway an update
+    __atomic_store_n(&pPage->magic, NTPSYNC_PAGE_MAGIC, __ATOMIC_RELEASE);
+}
+
+// Still the object of the name: the writer before may have removed it in between the open and the lock
+static int _page_is_named(int fd, char *name) {
+    struct stat a, b;
+    int fd2 = shm_open(name, O_RDONLY, 0);
+    int rc = fd2 >= 0 && fstat(fd, &a) == 0 && fstat(fd2, &b) == 0 && a.st_dev == b.st_dev && a.st_ino == b.st_ino;
+
+    if (fd2 >= 0)
+        close(fd2);
+    return rc;
+}
+
+// The page is written by a single synchronisation: the one holding the lock of its shared memory object,
+// in *pFd, until the stop. The lock goes with the writer which dies, whose page is taken over as it is.
+static tNtpSyncPage *_page_create(char *name, int *pFd) {
+    tNtpSyncPage *p;
+    int fd = -1, tries;
+
+    for (tries = 0; fd < 0 && tries < 3; tries++) {
+        if ((fd = shm_open(name, O_CREAT | O_RDWR, 0644)) < 0)
+            return NULL;
+
+        if (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+            if (errno == EWOULDBLOCK) {
+                DEBUG_LEVEL(DEBUG_BASIC, NTPSYNC_DBG("-- The shared page %s is written by another synchronisation\n", name));
+                close(fd);
+                return NULL;
+            }
+            DEBUG_LEVEL(DEBUG_BASIC, NTPSYNC_DBG("-- Can't lock the shared page %s (%d)\n", name, errno)); // not on every system
+        } else if (!_page_is_named(fd, name)) {
+            close(fd);
+            fd = -1;
+        }
+    }
+
+    if (fd < 0)
+        return NULL;
+
+    if (ftruncate(fd, NTPSYNC_PAGE_SIZE) != 0) {
+        close(fd);
+        return NULL;
+    }
+
+    p = (tNtpSyncPage *)mmap(NULL, NTPSYNC_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    if (p == MAP_FAILED) {
+        close(fd);
+        return NULL;
+    }
+
+    _page_init(p);
+    *pFd = fd;
+    return p;
+}
+
+// Move the readers from the page src to dst, which goes on with the last timebase of src
+static void _page_handover(tNtpSyncPage *dst, const tNtpSyncPage *src) {
+    tNtpSyncTimebase tb;
+    uint32_t seq = dst->seq;
+
+    ntp_sync_page_read(src, &tb);
+    __atomic_store_n(&dst->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    dst->tb = tb;
+    __atomic_store_n(&dst->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+#define NTP_PKT_BUF_SZ 8
 
+// A request in flight: the server echoes its transmit timestamp in the origin one of the reply
 typedef struct {
-    double send_ts[2];
-    double recv_ts[2];
-    double offset;
-    double delay;
-    double dispersion;
-} tTimeStats;
+    tstamp xmt;
+    int64_t send_ts[2];     // local clock around the send [ns]
+    uint32_t tx_id;         // datagrams sent before this one
+    int64_t tx_ts;          // local clock when the kernel sent it [ns], 0 if unknown
+} tNtpRequest;
 
+#define NTP_MAX_PEERS   8
+
+// A server and what it told us
+typedef struct {
+    char host[NAME_MAX];
+    int port;
+    int comm;               // udp socket connected to the server
+    int tx_timestamps;      // t1 from the kernel transmit timestamps
+    uint32_t tx_count;      // datagrams sent
+    int disabled;           // it sent a kiss of death or something that cannot be understood
+    uint8_t reach;          // shift register of the bursts it completed
+    tNtpPkt last;           // last reply: the requests echo its timestamps
+
+    // -- current burst
+    tNtpRequest req[NTP_PKT_BUF_SZ]; // in flight, the oldest first
+    int n_req;
+    int64_t next_send;      // [ns]
+    int n;                  // samples collected
+    int ignored;            // replies left out by _ntp_check: they take the place of samples in the burst
+    int fresh;              // the filter output a new sample
+    int survivor;           // of the last mitigation: its samples feed the estimator
+    eNtpSyncError error;    // of the burst, if any
+
+    tNtpGate gate;          // rejects the outliers before they reach the filter
+    tNtpFilter filter;      // the samples of the last bursts
+    tNtpHuffPuff huffpuff;  // minimum delay of the path
+    int64_t offset;         // of the filter, corrected for the asymmetry of the path [ns]
+    int64_t distance;       // root distance: the bound of its error [ns]
+} tNtpPeer;
+
+#define CACHE_LINE      64
+#define CACHE_ALIGNED   __attribute__((aligned(CACHE_LINE)))
+
+// Flags shared between the sync thread and the api callers
+#define FLAG_GET(f)     __atomic_load_n(&(f), __ATOMIC_ACQUIRE)
+#define FLAG_SET(f, v)  __atomic_store_n(&(f), (v), __ATOMIC_RELEASE)
+#define FLAG_CAS(f, o, v) ({ __typeof__(f) _o = (o); __atomic_compare_exchange_n(&(f), &_o, (v), 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE); })
+
+// A user callback held back until the loop lock is released: cb_err or cb_ready, with err
+typedef struct {
+    tCbOnErr cb_err;
+    tCbOnReady cb_ready;
+    eNtpSyncError err;
+    void *prm;
+} tNtpSyncCall;
+
+#define CALLS_PER_STEP  2       // an error, then the readiness it brings
+
+// The regions sit on different cache lines, so that the sync thread updating its own
+// state or the flags doesn't evict the lines the readers are working on (false sharing)
 typedef struct {
-    tTime time;
-    int comm;               // udp communication socket
-    tstamp ntp_start_time;
-    double start_time;
-    double max_offset;      // maximum tolerated offset [seconds]
-    int inter_sync_delay;   // the time in between one synch and the following [ms]
-    int inited:1;
-    int synchronised:1;
-    int stop:1;
+    // -- read path: written only at start, at the first synchronisation and by ntp_sync_set_time
+    tNtpSyncPage *page CACHE_ALIGNED; // what the readers see of time
+    int64_t start_time_ns;  // [unix ns], FLAG_GET/FLAG_SET: the origin of the times
+
+    // -- sync thread
+    tTime time CACHE_ALIGNED;
+    eNtpSyncClock clock_source; // requested local clock source
+    eNtpSyncDiscipline discipline;
+    tNtpKalman kalman;      // estimated offset and skew, with eNtpSyncDiscipline_kalman
+    tNtpPeer peers[NTP_MAX_PEERS];
+    int n_peers;
+    int64_t max_offset;     // maximum tolerated offset [ns]
+    int inter_sync_delay;   // the longest time in between one synch and the following [ms]
+    int min_poll;           // the shortest one [ms]
+    int poll_count;         // updates within the noise (> 0) or out of it (< 0) at the current interval
+    int no_majority;        // updates in a row the servers didn't agree on
+    int burst_depth;        // requests in flight in a burst
+    int64_t huffpuff_window; // of the huff-n'-puff filter [ns], 0 when off
+    double gate_k;          // width of the outlier gate [MADs], 0 when off
+    int64_t poll;           // interval of the clock updates [ns]
+    tstamp last_sync;       // of the last adjustement, echoed in the requests
+    int bursting;
+    int64_t burst_start;    // [ns]
+    int64_t next_burst;     // [ns]
+    int iburst;             // tight bursts left to the start
+    int64_t start_t;        // local clock of the start [ns]
+    const char *state_file; // the warm start state, NULL when none
+    int64_t state_saved;    // local clock of its last save, or attempt [ns]
+    int on_loop;            // stepped within ntp_sync_process, which must not block: no save there
+    int64_t warm_band;      // a first offset within it confirms the state the start took the time from [ns]
+
+    // -- control: FLAG_GET/FLAG_SET only
+    int inited CACHE_ALIGNED;
+    int synchronised;
+    int stop;
     eNtpSyncError error;
     tCbOnErr cb_err;
     void *cb_err_prm;
+    int64_t burst_duration; // of the last burst [ns]
+    int poll_ms;            // interval of the clock updates [ms]
+    int64_t huffpuff_correction; // applied to the offset of the system peer at the last update [ns]
+    int64_t huffpuff_min_delay;  // of the system peer [ns]
+    uint64_t outliers_offset;    // samples rejected for their offset
+    uint64_t outliers_delay;     // samples rejected for their delay
+    int64_t start_latency;       // from the start to the first synchronisation [ns], 0 until then
+    int warm_start;              // what the start took from the state: 0 nothing, 1 the frequency, 2 the time too
+
+    // -- outcome of the start: the first synchronisation, or the error
+    int ready;              // under ready_lock
+    pthread_mutex_t ready_lock;
+    pthread_cond_t ready_cond;
+    int ready_fd;           // eventfd signalled then, -1 if none
+    tCbOnReady cb_ready;
+    void *cb_ready_prm;
+    tNtpSyncCall *calls;    // the callbacks go there rather than being called when not NULL: on the loop, lock held
+    int n_calls;
+
+    // -- monotonic floor: atomics only, written by the readers of the monotonic time
+    int64_t floor_ns CACHE_ALIGNED; // latest monotonic time returned [unix ns]
+    uint64_t clamped;       // monotonic reads that would have gone backwards
 } tNtpTime;
 
-#define NTP_PKT_BUF_SZ 8
-
 #define SET_NTP_PACKET(p) do { \
     (p)->lvmspp = 0;  \
     LI_SET(p, NOSYNC);                      /* clock unsynchronized */ \
@@ -201,11 +451,6 @@ typedef struct {
 
 #define HLFP(a)         ((unsigned long long)(a) >> 32)
 #define LLFP(a)         ((a) & 0xFFFFFFFF)
-#define SWAP_LFP(a)     (HLFP(a) | (LLFP(a) << 32))
-#define HB32T(p)        (*(int32_t *)(p) = SwapInt32HostToBig(*(int32_t *)(p)))
-#define BH32T(p)        (*(int32_t *)(p) = SwapInt32BigToHost(*(int32_t *)(p)))
-#define SWAPHB_LFP(l)   HB32T(l); HB32T((int32_t *)(l)+1)
-#define SWAPBH_LFP(l)   BH32T(l); BH32T((int32_t *)(l)+1)
 
 static void _ntp_host_2_big(tNtpPkt *p) {
     p->lvmspp = SwapInt32HostToBig(p->lvmspp);
@@ -223,16 +468,10 @@ static void _ntp_big_2_host(tNtpPkt *p) {
     p->rootdelay = SwapInt32BigToHost(p->rootdelay);
     p->rootdisp = SwapInt32BigToHost(p->rootdisp);
     p->refid = SwapInt32BigToHost(p->refid);
-    SWAPBH_LFP(&p->reference_ts);
-    SWAPBH_LFP(&p->origin_ts);
-    SWAPBH_LFP(&p->receive_ts);
-    SWAPBH_LFP(&p->transmit_ts);
-#if LITTLE_ENDIAN
-    p->reference_ts = SWAP_LFP(p->reference_ts);
-    p->origin_ts = SWAP_LFP(p->origin_ts);
-    p->receive_ts = SWAP_LFP(p->receive_ts);
-    p->transmit_ts = SWAP_LFP(p->transmit_ts);
-#endif
+    p->reference_ts = SwapInt64BigToHost(p->reference_ts);
+    p->origin_ts = SwapInt64BigToHost(p->origin_ts);
+    p->receive_ts = SwapInt64BigToHost(p->receive_ts);
+    p->transmit_ts = SwapInt64BigToHost(p->transmit_ts);
 }
 
 static char *_ntp_print(char *buf, int size, tNtpPkt *p) {
@@ -267,28 +506,100 @@ static char *_ntp_print(char *buf, int size, tNtpPkt *p) {
     return buf;
 }
 
+// Measure the coarse clock against the local one right on a coarse tick edge. Readers may come
+// anywhere within the tick, hence the offset is centred on the tick. The coarse clock is NTP disciplined
+// by the kernel, so the offset drifts: its rate follows the slope in between the measures (averaged, as the
+// tick edges jitter), and the error is half a tick plus how far the offset moved from where the rate predicted.
+// The measure is the same for all the instances: a recent one is shared, rather than spinning on a tick
+// per instance and per adjustement. The coarse clock moves against the local one by its NTP slew, which
+// in COARSE_SHARE ns is well within its resolution.
+#define COARSE_SHARE    100000000LL     // [ns]
+#define COARSE_RATE_MIN 1000000000LL    // the shortest baseline of the rate [ns]
+#define COARSE_RATE_MAX (1000 * TWO_E32 / 1000000) // 1000 ppm, past the largest kernel slew
+#define COARSE_RATE_AVG 4               // rate samples averaging constant
+
+static pthread_mutex_t s_coarse_lock = PTHREAD_MUTEX_INITIALIZER;
+static int64_t s_coarse_ofs, s_coarse_t;
+
+static void _coarse_calibrate(tTime *pT) {
+    struct timespec res;
+    int64_t c0, c, l, ofs, slope;
+
+    if (clock_getres(NTPSYNC_PAGE_COARSE_CLOCK, &res) != 0)
+        res.tv_sec = res.tv_nsec = 0;
+    pT->coarse_res = MAX((int64_t)res.tv_sec * NSECS_PER_SEC + res.tv_nsec, 1);
+
+    pthread_mutex_lock(&s_coarse_lock);
+    l = GETNSECS();
+
+    if (s_coarse_t != 0 && l - s_coarse_t < COARSE_SHARE) {
+        ofs = s_coarse_ofs;
+        l = s_coarse_t;
+    } else {
+        c0 = NTPSYNC_PAGE_COARSE_NSECS();
+        do { // at most one tick
+            c = NTPSYNC_PAGE_COARSE_NSECS();
+        } while (c == c0 && GETNSECS() - l < 2 * pT->coarse_res);
+        l = GETNSECS();
+
+        s_coarse_ofs = ofs = l - c + pT->coarse_res / 2;
+        s_coarse_t = l;
+    }
+    pthread_mutex_unlock(&s_coarse_lock);
+
+    if (pT->coarse_t == 0) {
+        pT->coarse_err = pT->coarse_res;
+        pT->coarse_ofs = ofs;
+        pT->coarse_t = l;
+    } else
+    if (l - pT->coarse_t >= COARSE_RATE_MIN) {
+        pT->coarse_err = pT->coarse_res / 2 + ABS(ofs - (pT->coarse_ofs + ntp_sync_mul_q32(l - pT->coarse_t, pT->coarse_rate)));
+        slope = (int64_t)((double)(ofs - pT->coarse_ofs) / (l - pT->coarse_t) * TWO_E32);
+        slope = MAX(MIN(slope, COARSE_RATE_MAX), -COARSE_RATE_MAX);
+        pT->coarse_rate = pT->coarse_rate == 0 ? slope : pT->coarse_rate + (slope - pT->coarse_rate) / COARSE_RATE_AVG;
+        pT->coarse_ofs = ofs;
+        pT->coarse_t = l;
+    }
+
+    DEBUG_LEVEL(DEBUG_DEEP, NTPSYNC_DBG("-- Coarse clock: offset = %.9f, rate = %.3f ppm, resolution = %.9f, error = %.9f\n", NS2D(pT->coarse_ofs), (double)pT->coarse_rate / TWO_E32 * 1000000, NS2D(pT->coarse_res), NS2D(pT->coarse_err)));
+}
+
+// Keep the alternative local clocks aligned to the system clock
+static void _calibrate_clocks(tTime *pT) {
+
+    if (pT->tsc.valid && tsc_clock_calibrate(&pT->tsc, _getnsecs) != 0)
+        DEBUG_LEVEL(DEBUG_BASIC, NTPSYNC_DBG("%s", "-- TSC clock source lost, using the system clock\n"));
+
+    _coarse_calibrate(pT);
+}
+
 #define TRIALS 20
 
-static void _init_time(tTime *pT) {
+static void _init_time(tTime *pT, eNtpSyncClock clock_source) {
     struct timeval unix_time[TRIALS];
-    double delays[TRIALS];
-    double tzero_sys[TRIALS];
+    int64_t delays[TRIALS];
+    int64_t tzero_sys[TRIALS];
     int i = 0, best = 0;
 
     for(i = 0; i < TRIALS; i++) {
-        delays[i] = GETSECS();
+        delays[i] = GETNSECS();
         gettimeofday(&unix_time[i], NULL);
-        tzero_sys[i] = GETSECS();
+        tzero_sys[i] = GETNSECS();
         delays[i] = tzero_sys[i] - delays[i];
         best = delays[i]  < delays[best] ? i : best;
     }
 
     memset(pT, 0, sizeof(tTime));
-    pT->tzero_wck = (double)unix_time[best].tv_sec + (double)unix_time[best].tv_usec / 1e6;
+    pT->tzero_wck = (int64_t)unix_time[best].tv_sec * NSECS_PER_SEC + (int64_t)unix_time[best].tv_usec * 1000;
     pT->tzero_ntp_wck = U2LFP(unix_time[best]);
     pT->tzero_sys = tzero_sys[best] - delays[best]/2;
 
-    DEBUG_LEVEL(DEBUG_MEDIUM, NTPSYNC_DBG("-- Init (%d): tsys = %.10f delay = %.10f ts(ux/ntp) = %.10f/%lu.%lu\n", best, pT->tzero_sys, delays[best], pT->tzero_wck, (unsigned long)HLFP(pT->tzero_ntp_wck), (unsigned long)LLFP(pT->tzero_ntp_wck)));
+    if (clock_source == eNtpSyncClock_tsc && tsc_clock_init(&pT->tsc, _getnsecs) != 0)
+        DEBUG_LEVEL(DEBUG_BASIC, NTPSYNC_DBG("%s", "-- TSC clock source not reliable, using the system clock\n"));
+
+    _coarse_calibrate(pT);
+
+    DEBUG_LEVEL(DEBUG_MEDIUM, NTPSYNC_DBG("-- Init (%d): tsys = %.9f delay = %.9f ts(ux/ntp) = %.9f/%lu.%lu\n", best, NS2D(pT->tzero_sys), NS2D(delays[best]), NS2D(pT->tzero_wck), (unsigned long)HLFP(pT->tzero_ntp_wck), (unsigned long)LLFP(pT->tzero_ntp_wck)));
 }
 
 #undef TRIALS
@@ -305,322 +616,1830 @@ static void _init_time(tTime *pT) {
 } while(0);
 
 
-// Slew the clock at 1 correction each 1 ms to decrease the chance to invert the monotonicity of the psy timestamps
-// With max_offset = 0.0005 sec, that means at most 0.5 us correction each ms
-static void _slew_clock(tTime *pT, double max_offset) {
-    double range_ms = (ABS(pT->ofs_rel) / max_offset) * 2 * 1000;
-    double inc = pT->ofs_rel / range_ms;
+// Slew the clock from the offset "from" (the one readers see at now) to pT->offset at max_offset / 2 per second,
+// that is at most 0.25 ms/s with max_offset = 0.5 ms, so that the monotonicity of the timestamps is preserved.
+// The readers evaluate the slew themselves: the sync thread only sets it up and goes on sampling.
+static void _slew_clock(tTime *pT, int64_t from, int64_t now, int64_t max_offset) {
+    double range = max_offset > 0 ? (double)ABS(pT->offset - from) * 2 * NSECS_PER_SEC / max_offset : 0; // [ns]
 
-    DEBUG_LEVEL(DEBUG_MEDIUM, NTPSYNC_DBG("-- Slewing clock by %f ms per ms, for the next %f ms\n", inc * 1000, range_ms));
+    pT->slew.start = now;
+    pT->slew.end = now + (int64_t)range;
+    pT->slew.from = from;
+    pT->slew.rate = range > 0 ? (int64_t)((pT->offset - from) / range * TWO_E32) : 0;
 
-    if (inc > 0) {
-        while(pT->slewed_offset + inc < pT->offset) {
-            pT->slewed_offset += inc;
-            usleep(max_offset * 2 * 1000000);
-        }
-    } else {
-        while(pT->slewed_offset + inc > pT->offset) {
-            pT->slewed_offset += inc;
-            usleep(max_offset * 2 * 1000000);
-        }
-    }
-    pT->slewed_offset = pT->offset;
+    DEBUG_LEVEL(DEBUG_MEDIUM, NTPSYNC_DBG("-- Slewing clock by %.3f ns per ms, for the next %.3f ms\n", (double)pT->slew.rate / TWO_E32 * 1000000, range / 1000000));
 }
 
-static void _adjust_clock(tTime *pTime, tTimeStats pStats[NTP_PKT_BUF_SZ], double max_offset) {
-    double uncertainty[NTP_PKT_BUF_SZ];
-    int i, best = 0, best_count = 0;
+#define FREQ_MAX            (500 * TWO_E32 / 1000000)   // 500 ppm, the NTP tolerance of the local oscillator
+#define FREQ_AVG            4                           // frequency samples averaging constant
+#define FREQ_MIN_INTERVAL   (INTER_SYNC_DELAY_MIN * 1000LL)
 
-    for (i = 0; i < NTP_PKT_BUF_SZ; i++) {
-        uncertainty[i] = (pStats[i].send_ts[1] - pStats[i].send_ts[0]) + (pStats[i].recv_ts[1] - pStats[i].recv_ts[0]); //- pStats[i].delay;
-        best_count += uncertainty[i] == uncertainty[best] ? 1 : 0;
-        best = uncertainty[i] < uncertainty[best] ? i : best;
-        DEBUG_LEVEL(DEBUG_DEEP, NTPSYNC_DBG("-- %d, Uncertainty %f, delay = %f, offset = %f\n", i, uncertainty[i], pStats[i].delay, pStats[i].offset));
-    }
+// Frequency locked loop: the residual offset measured after interval ns is what the local clock drifted
+// with the current frequency correction. The correction moves towards it, so that the time extrapolated
+// between the adjustements stays accurate even when these are minutes apart.
+static void _set_frequency(tTime *pT, int64_t freq) {
+    double step;
 
-    DEBUG_LEVEL(DEBUG_DEEP, NTPSYNC_DBG("-- Found %d possible optimal choices\n", best_count));
+    freq = MAX(MIN(freq, FREQ_MAX), -FREQ_MAX);
+    step = (double)(freq - pT->freq);
+    pT->wander = (int64_t)sqrt(((double)pT->wander * pT->wander * (FREQ_AVG - 1) + step * step) / FREQ_AVG);
+    pT->freq = freq;
+}
 
-    if (best_count > 1) {
-        for (i = 0; best_count > 0 && i < NTP_PKT_BUF_SZ; i++) {
-            if (uncertainty[i] == uncertainty[best]) {
-                best = pStats[i].delay < pStats[best].delay ? i : best;
-                best_count--;
-            }
-        }
+static void _discipline_frequency(tTime *pT, int64_t ofs_rel, int64_t interval) {
+
+    if (interval < FREQ_MIN_INTERVAL)
+        return;
+
+    _set_frequency(pT, pT->freq + (int64_t)((double)ofs_rel / interval * TWO_E32 / FREQ_AVG));
+
+    DEBUG_LEVEL(DEBUG_MEDIUM, NTPSYNC_DBG("-- Frequency correction %.3f ppm (residual %.3f ppm over %.3f s)\n", (double)pT->freq / TWO_E32 * 1000000, (double)ofs_rel / interval * 1000000, NS2D(interval)));
+}
+
+#define POLL_PGATE      4       // an offset within this many jitters is noise
+#define POLL_LIMIT      4       // updates in (out of) the noise before the interval doubles (halves)
+
+// Poll adjust, after the jiggle counter of rfc5905: the interval doubles after a few updates whose offset is noise,
+// if the drift the frequency wander accumulates over it stays well within max_offset, and halves after a couple
+// of updates out of the noise. An offset of half max_offset or more brings it straight back to the minimum.
+// Returns the next interval [ns].
+static int64_t _adjust_poll(tNtpTime *pNtp, int64_t poll, int adjusted, int64_t offset, int64_t jitter) {
+    int64_t drift = ntp_sync_mul_q32(2 * poll, pNtp->time.wander);
+
+    if (!adjusted)
+        pNtp->poll_count -= 2;
+    else
+    if (ABS(offset) >= pNtp->max_offset / 2) {
+        pNtp->poll_count = 0;
+        poll = pNtp->min_poll * 1000000LL;
+    }
+    else
+    if (ABS(offset) < POLL_PGATE * jitter && drift < pNtp->max_offset / 4)
+        pNtp->poll_count++;
+    else
+        pNtp->poll_count -= 2;
+
+    if (pNtp->poll_count >= POLL_LIMIT || pNtp->poll_count <= -POLL_LIMIT) {
+        poll = pNtp->poll_count > 0 ? poll * 2 : poll / 2;
+        pNtp->poll_count = 0;
     }
+    poll = MAX(MIN(poll, pNtp->inter_sync_delay * 1000000LL), pNtp->min_poll * 1000000LL);
+
+    DEBUG_LEVEL(DEBUG_MEDIUM, NTPSYNC_DBG("-- Poll %lld ms (count %d): offset = %.9f, jitter = %.9f, wander = %.3f ppm\n", (long long)poll / 1000000, pNtp->poll_count, NS2D(offset), NS2D(jitter), (double)pNtp->time.wander / TWO_E32 * 1000000));
+    FLAG_SET(pNtp->poll_ms, (int)(poll / 1000000));
+    return poll;
+}
 
-    pTime->offset += pStats[best].offset;
-    pTime->tsync_sys = GETSECS();
-    pTime->delay = pStats[best].delay;
-    pTime->ofs_rel = pStats[best].offset;
+// Adjust the clock by the offset of the servers, measured with a round trip of delay. The frequency is
+// the skew of the estimator when there is one (pKalman), else the one of the frequency locked loop.
+static void _adjust_clock(tTime *pTime, tNtpSyncPage *pPage, int64_t offset, int64_t delay, int64_t max_offset, const tNtpKalman *pKalman) {
+    int64_t now, from, fofs, interval;
+
+    now = GETNSECS();
+    // the frequency correction accumulated so far becomes part of the offset: the new one starts from now
+    fofs = FREQ_OFS(pTime, now);
+    from = SLEWED_OFS(pTime, now) + fofs; // a previous slew may still be running
+    interval = now - pTime->tsync_sys;
+    pTime->offset += fofs + offset;
+    pTime->tsync_sys = now;
+
+    if (pKalman != NULL)
+        _set_frequency(pTime, (int64_t)(pKalman->skew / NSECS_PER_SEC * TWO_E32));
+    else
+    if (pTime->adjustements > 0)
+        _discipline_frequency(pTime, offset, interval);
+    pTime->delay = delay;
+    pTime->ofs_rel = offset;
 
     pTime->adjustements++;
     // do this only after the first adjustement
     if (pTime->adjustements == 2)
-        pTime->ofs_rel_max = pTime->ofs_rel_min = pStats[best].offset;
+        pTime->ofs_rel_max = pTime->ofs_rel_min = offset;
     else
     if (pTime->adjustements > 2) {
-        pTime->ofs_rel_max = MAX(pTime->ofs_rel_max, pStats[best].offset);
-        pTime->ofs_rel_min = MIN(pTime->ofs_rel_min, pStats[best].offset);
+        pTime->ofs_rel_max = MAX(pTime->ofs_rel_max, offset);
+        pTime->ofs_rel_min = MIN(pTime->ofs_rel_min, offset);
     }
 
-    DEBUG_LEVEL(DEBUG_MEDIUM, NTPSYNC_DBG("-- CKADJ %d, best choice: abs-ofs = %f rel-ofs(min = %f / cur = %f / max = %f), delay = %f, sync = %f, measurement delay = %f\n", pTime->adjustements, pTime->offset, pTime->ofs_rel_min, pTime->ofs_rel, pTime->ofs_rel_max, pTime->delay, pTime->tsync_sys, uncertainty[best]));
+    DEBUG_LEVEL(DEBUG_MEDIUM, NTPSYNC_DBG("-- CKADJ %d: abs-ofs = %.9f rel-ofs(min = %.9f / cur = %.9f / max = %.9f), delay = %.9f, sync = %.9f\n", pTime->adjustements, NS2D(pTime->offset), NS2D(pTime->ofs_rel_min), NS2D(pTime->ofs_rel), NS2D(pTime->ofs_rel_max), NS2D(pTime->delay), NS2D(pTime->tsync_sys)));
 
     if (pTime->adjustements == 1) { // adjust clock abruptely
-        pTime->slewed_offset = pTime->offset;
-        DEBUG_LEVEL(DEBUG_MEDIUM, NTPSYNC_DBG("-- First synch, clock offset set to %f\n", pTime->offset));
+        _slew_clock(pTime, pTime->offset, now, max_offset);
+        DEBUG_LEVEL(DEBUG_MEDIUM, NTPSYNC_DBG("-- First synch, clock offset set to %.9f\n", NS2D(pTime->offset)));
     } else // do it slowly
-        _slew_clock(pTime, max_offset);
+        _slew_clock(pTime, from, now, max_offset);
+
+    _clock_publish(pPage, pTime);
+}
+
+static void _call_now(const tNtpSyncCall *c) {
+
+    if (c->cb_err != NULL)
+        c->cb_err(c->err, c->prm);
+    else
+        c->cb_ready(c->err, c->prm);
+}
+
+// Call back the user, or hold the call back when within the loop: the callback may stop the instance
+static void _call(tNtpTime *pNtp, tCbOnErr cb_err, tCbOnReady cb_ready, eNtpSyncError err, void *prm) {
+    tNtpSyncCall c = { cb_err, cb_ready, err, prm };
+
+    if (pNtp->calls == NULL)
+        _call_now(&c);
+    else if (pNtp->n_calls < CALLS_PER_STEP)
+        pNtp->calls[pNtp->n_calls++] = c;
+}
+
+// Wake up whoever waits for the outcome of the start, once: the first synchronisation, or the first error
+static void _ready(tNtpTime *pNtp) {
+    uint64_t one = 1;
+    int first;
+
+    pthread_mutex_lock(&pNtp->ready_lock);
+    first = !pNtp->ready;
+    pNtp->ready = 1;
+    pthread_cond_broadcast(&pNtp->ready_cond);
+    pthread_mutex_unlock(&pNtp->ready_lock);
+
+    if (!first)
+        return;
+
+    if (pNtp->ready_fd >= 0 && write(pNtp->ready_fd, &one, sizeof(one)) < 0)
+        DEBUG_LEVEL(DEBUG_BASIC, NTPSYNC_DBG("-- Failed to signal the readiness (%d)\n", errno));
+
+    if (pNtp->cb_ready != NULL)
+        _call(pNtp, NULL, pNtp->cb_ready, FLAG_GET(pNtp->error), pNtp->cb_ready_prm);
 }
 
 static void _error(tNtpTime *pNtp, eNtpSyncError what) {
-    pNtp->error = what;
+    FLAG_SET(pNtp->error, what);
 
     if (pNtp->cb_err != NULL)
-        pNtp->cb_err(pNtp->error, pNtp->cb_err_prm);
+        _call(pNtp, pNtp->cb_err, NULL, what, pNtp->cb_err_prm);
+    _ready(pNtp);
 }
 
-static void *_ntp_sync(void *prm) {
-    tNtpPkt pbuf[NTP_PKT_BUF_SZ], packet, packet_dbg;
-    int inter_sync_delay = INTER_SYNC_DELAY_MIN;
-    tNtpTime *pNtp = (tNtpTime *)prm;
-    tTimeStats ts[NTP_PKT_BUF_SZ];
-    tstamp org, rec, xmt;
-    int i = 0, ignore;
-    double max_offset;
-    double delay;
-    tstamp last_sync;
+#define BURST_SPACING       250000          // in between two requests of a burst [ns]
+#define BURST_TIMEOUT       500000000LL     // a reply not received by then is lost [ns]
+
+// The request is built on the last reply received, as the baseline client loop did
+static int _ntp_send(tNtpTime *pNtp, tNtpPeer *pPeer, tstamp last_sync, tNtpRequest *pReq) {
+    tNtpPkt packet = pPeer->last, packet_dbg;
+
+    SET_NTP_PACKET(&packet);
+    // we send a not sync packet, so rootdelay and rootdisp are not going to be considered by the server
+    packet.rootdisp = 0;
+    packet.rootdelay = 0;
+    packet.reference_ts = last_sync;
+    DEBUG_LEVEL(DEBUG_DEEP, packet_dbg = packet); // this will affect the delay... but it's done only in debug mode DEBUG_DEEP
+
+    _ntp_host_2_big(&packet); // on partial data, to shorten the delay
+    pReq->send_ts[0] = GETNSECS();
+    pReq->xmt = LOC_2_NTP(&pNtp->time, pReq->send_ts[0]);
+    packet.transmit_ts = SwapInt64HostToBig(pReq->xmt);
+
+    // this will affect the delay... but it's done only in debug mode DEBUG_DEEP
+    DEBUG_OPEN(DEBUG_DEEP)
+    char buf[512];
+    packet_dbg.transmit_ts = pReq->xmt;
+    NTPSYNC_DBG("-- (send to %s) %s\n", pPeer->host, _ntp_print(buf, sizeof(buf), &packet_dbg));
+    DEBUG_CLOSE
+
+    if (udp_send(pPeer->comm, (char *)&packet, NTP_PACKET_SIZE) != NTP_PACKET_SIZE)
+        return 1;
+
+    pReq->send_ts[1] = GETNSECS();
+    pReq->tx_id = pPeer->tx_count++;
+    pReq->tx_ts = 0;
+    return 0;
+}
 
-    DEBUG_LEVEL(DEBUG_MEDIUM, NTPSYNC_DBG("%s", "-- Started\n"));
-    _init_time(&pNtp->time);
-    last_sync = 0;
-    memset(&packet, 0, NTP_PACKET_SIZE);
-    org = 0;
-    rec = 0;
-
-    while(!pNtp->stop) {
-        ignore = 0;
-        delay = GETSECS();
-
-        SET_NTP_PACKET(&packet);
-        // we send a not sync packet, so rootdelay and rootdisp are not going to be considered by the server
-        packet.rootdisp = 0;
-        packet.rootdelay = 0;
-        packet.reference_ts = last_sync;
-        DEBUG_LEVEL(DEBUG_DEEP, packet_dbg = packet); // this will affect the delay... but it's done only in debug mode DEBUG_DEEP
-
-        _ntp_host_2_big(&packet); // on partial data, to shorten the delay
-        ts[i].send_ts[0] = GETSECS();
-        packet.transmit_ts = SwapInt64HostToBig(LOC_2_NTP(&pNtp->time, ts[i].send_ts[0]));
-
-        // this will affect the delay... but it's done only in debug mode DEBUG_DEEP
-        DEBUG_OPEN(DEBUG_DEEP)
-        char buf[512];
-        packet_dbg.transmit_ts = SwapInt64BigToHost(packet.transmit_ts);
-        NTPSYNC_DBG("-- (send) %s\n", _ntp_print(buf, sizeof(buf), &packet_dbg));
-        DEBUG_CLOSE
-
-        if (udp_send(pNtp->comm, (char *)&packet, NTP_PACKET_SIZE) != NTP_PACKET_SIZE) {
-            _error(pNtp, eNtpSyncError_send);
-            break;
-        }
+// A server which cannot be understood, or which asked to be left alone, is not polled any more
+static void _peer_fail(tNtpPeer *pPeer, eNtpSyncError what) {
+    pPeer->error = what;
+    pPeer->n_req = 0;
+    pPeer->disabled = what == eNtpSyncError_version || what == eNtpSyncError_kod || what == eNtpSyncError_unexpected;
 
-        ts[i].send_ts[1] = ts[i].recv_ts[0] = GETSECS();
-        xmt = SwapInt64BigToHost(packet.transmit_ts);
+    DEBUG_LEVEL(DEBUG_BASIC, NTPSYNC_DBG("-- Server %s:%d failed (%d)%s\n", pPeer->host, pPeer->port, what, pPeer->disabled ? ", disabled" : ""));
+}
 
-        if (udp_receive(pNtp->comm, (char *)&packet, NTP_PACKET_SIZE) != NTP_PACKET_SIZE) {
-            _error(pNtp, eNtpSyncError_receive);
-            break;
+// Assign the kernel transmit timestamps queued so far to the requests in flight: how many entries were read.
+// The departure time is the true t1: the one in the request is taken before the send syscall and the qdisc.
+// An error queued along with them (ie. the server port unreachable) fails the peer.
+static int _ntp_tx_timestamps(tNtpPeer *pPeer) {
+    int64_t age, now;
+    uint32_t id;
+    int i, err, n = 0;
+
+    while (udp_receive_tx_ts(pPeer->comm, &id, &age, &err) == 1) {
+        now = GETNSECS();
+        n++;
+
+        if (err != 0) {
+            DEBUG_LEVEL(DEBUG_BASIC, NTPSYNC_DBG("-- Request to %s rejected (%d)\n", pPeer->host, err));
+            _peer_fail(pPeer, eNtpSyncError_send);
+            continue;
         }
 
-        ts[i].recv_ts[1] = GETSECS();
+        for (i = 0; age >= 0 && i < pPeer->n_req; i++) {
+            if (pPeer->req[i].tx_id == id && now - age >= pPeer->req[i].send_ts[0]) // a stamp before the send is not believable
+                pPeer->req[i].tx_ts = now - age;
+        }
+    }
+    return n;
+}
 
-        _ntp_big_2_host(&packet);
+// Check a reply: eNtpSyncError_no if its timestamps can be used, -1 to ignore it, else the error
+static int _ntp_check(tNtpPkt *pPacket, tNtpPkt *pLast, tstamp xmt) {
 
-        DEBUG_OPEN(DEBUG_DEEP)
-        char buf[512];
-        NTPSYNC_DBG("-- (recv) %s\n", _ntp_print(buf, sizeof(buf), &packet));
-        DEBUG_CLOSE
+    if (VN(pPacket) > VERSION) {
+        DEBUG_LEVEL(DEBUG_BASIC, NTPSYNC_DBG("-- Wrong version packet: (%d)\n", VN(pPacket)));
+        return eNtpSyncError_version;
+    }
 
-        if (VN(&packet) > VERSION) {
-            DEBUG_LEVEL(DEBUG_BASIC, NTPSYNC_DBG("-- Wrong version packet: (%d)\n", VN(&packet)));
-            _error(pNtp, eNtpSyncError_version);
-            break;
+    if (STRATUM(pPacket) == 0)  { // Kiss-Of-Death packet, ignore timestamps for they are unreliable and quit
+        DEBUG_LEVEL(DEBUG_BASIC, NTPSYNC_DBG("-- Received a Kiss-Of-Death packet: (%-.4s)\n", (char *)&pPacket->refid));
+        return eNtpSyncError_kod;
+    }
+
+    if (MODE(pPacket) == M_BCST) {
+        DEBUG_LEVEL(DEBUG_BASIC, NTPSYNC_DBG("%s", "-- Broadcast packet: ignore\n"));
+        return -1;
+    }
+
+    if (pPacket->transmit_ts == 0) { // invalid timestamp: something is badly wrong
+        DEBUG_LEVEL(DEBUG_BASIC, NTPSYNC_DBG("%s", "-- Invalid timestamp\n"));
+        return eNtpSyncError_unexpected;
+    }
+
+    if (xmt == pPacket->transmit_ts) { // check for duplicate or replay
+        DEBUG_LEVEL(DEBUG_BASIC, NTPSYNC_DBG("%s", "-- Duplicate or replay: ignore\n"));
+        return -1;
+    }
+
+    if (pLast->origin_ts == pPacket->transmit_ts) { // check for bogus
+        DEBUG_LEVEL(DEBUG_BASIC, NTPSYNC_DBG("%s", "-- Bogus: ignore\n"));
+        return -1;
+    }
+
+    if (LI(pPacket) == NOSYNC || STRATUM(pPacket) >= MAXSTRAT) {
+        DEBUG_LEVEL(DEBUG_BASIC, NTPSYNC_DBG("%s", "-- Unsynchronised source\n"));
+        return -1;
+    }
+
+    if (FP2D(pPacket->rootdelay) / 2 + FP2D(pPacket->rootdisp) >= MAXDISP || pPacket->reference_ts > pPacket->transmit_ts) {
+        DEBUG_LEVEL(DEBUG_BASIC, NTPSYNC_DBG("%s", "-- Invalid header values\n"));
+        return -1;
+    }
+    return eNtpSyncError_no;
+}
+
+// Read a reply from the peer and turn it into a sample
+static void _peer_receive(tNtpTime *pNtp, tNtpPeer *pPeer) {
+    tNtpPkt packet;
+    int64_t recv_ts, age;
+    int i, rc;
+
+    // the transmit timestamps wake up the wait too: the reply may not be there yet
+    if (pPeer->tx_timestamps && _ntp_tx_timestamps(pPeer) > 0)
+        return;
+
+    if ((rc = udp_receive_ts(pPeer->comm, (char *)&packet, NTP_PACKET_SIZE, &age)) != NTP_PACKET_SIZE) {
+        if (rc >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) // else nothing to read after all
+            _peer_fail(pPeer, eNtpSyncError_receive);
+        return;
+    }
+
+    // t4 from the kernel receive timestamp when there is one: the wakeup latency is not part of it
+    recv_ts = GETNSECS();
+    recv_ts -= age > 0 ? age : 0;
+
+    _ntp_big_2_host(&packet);
+
+    DEBUG_OPEN(DEBUG_DEEP)
+    char buf[512];
+    NTPSYNC_DBG("-- (recv from %s) %s\n", pPeer->host, _ntp_print(buf, sizeof(buf), &packet));
+    DEBUG_CLOSE
+
+    for (i = 0; i < pPeer->n_req && pPeer->req[i].xmt != packet.origin_ts; i++)
+        ;
+
+    if (i == pPeer->n_req) { // the request is not in flight any more, or never was
+        DEBUG_LEVEL(DEBUG_BASIC, NTPSYNC_DBG("%s", "-- Late, duplicate or unexpected reply: ignore\n"));
+        return;
+    }
+
+    rc = _ntp_check(&packet, &pPeer->last, pPeer->req[i].xmt);
+
+    if (rc > 0) {
+        _peer_fail(pPeer, rc);
+        return;
+    }
+
+    pPeer->ignored += rc < 0;
+
+    if (rc == 0) {
+        tNtpRequest *pReq = &pPeer->req[i];
+        tNtpSample sample;
+        tstamp t1, t2, t3, t4;
+        int kernel_tx = pReq->tx_ts > 0 && pReq->tx_ts <= recv_ts;
+
+        // the differences are taken in ntp fixed point, so that no precision is lost
+        t1 = kernel_tx ? LOC_2_NTP(&pNtp->time, pReq->tx_ts) : pReq->xmt;
+        t2 = packet.receive_ts;
+        t3 = packet.transmit_ts;
+        t4 = LOC_2_NTP(&pNtp->time, recv_ts);
+
+        // without the kernel transmit time, the delay includes the time the send took (the thread may be
+        // interrupted in between): the sample of least delay is also the one least affected
+        sample.offset = LFP2NS(((t2 - t1) + (t3 - t4)) / 2);
+        sample.delay  = LFP2NS((t4 - t1) - (t3 - t2));
+        sample.dispersion = (int64_t)((LOG2D((signed char)PRECISION(&packet)) + LOG2D(CKPRECISION) + PHI*LFP2D(t4 - t1)) * NSECS_PER_SEC);
+        sample.t = recv_ts;
+
+        DEBUG_LEVEL(DEBUG_DEEP, NTPSYNC_DBG("-- Packet %d from %s: relative offset = %.9f, delay = %.9f, dispersion = %.9f, rx age = %.9f, tx kernel = %d, (%f, %f, %f ,%f)\n", pPeer->n, pPeer->host, NS2D(sample.offset), NS2D(sample.delay), NS2D(sample.dispersion), NS2D(age), kernel_tx, LFP2D(LFP70(t1)), LFP2D(LFP70(t2)), LFP2D(LFP70(t3)), LFP2D(LFP70(t4))));
+
+        if (ntp_gate_check(&pPeer->gate, &sample) == 0) {
+            pPeer->fresh |= ntp_filter_add(&pPeer->filter, &sample, pNtp->poll);
+            ntp_huffpuff_add(&pPeer->huffpuff, sample.delay, sample.t);
+
+            // the estimator works on the offset from the local clock, not on the one from the current correction
+            if (pNtp->discipline == eNtpSyncDiscipline_kalman && pPeer->survivor)
+                ntp_kalman_update(&pNtp->kalman, pNtp->time.offset + FREQ_OFS(&pNtp->time, sample.t) + ntp_huffpuff_correct(&pPeer->huffpuff, sample.offset, sample.delay),
+                                  (int64_t)sqrt((double)sample.delay * sample.delay / 4 + (double)sample.dispersion * sample.dispersion), sample.t);
         }
-        else
-        if (STRATUM(&packet) == 0)  { // Kiss-Of-Death packet, ignore timestamps for they are unreliable and quit
-            DEBUG_LEVEL(DEBUG_BASIC, NTPSYNC_DBG("-- Received a Kiss-Of-Death packet: (%-.4s)\n", (char *)&packet.refid));
-            _error(pNtp, eNtpSyncError_kod);
-            break;
-        } else {
-            pbuf[i] = packet;
-            packet.receive_ts = LOC_2_NTP(&pNtp->time, ts[i].recv_ts[1]);
+        pPeer->n++;
+    }
 
-            if (MODE(&packet) == M_BCST) {
-                DEBUG_LEVEL(DEBUG_BASIC, NTPSYNC_DBG("%s", "-- Broadcast packet: ignore\n"));
-                ignore++;
-            }
-            else
-            if (packet.transmit_ts == 0) { // invalid timestamp: something is badly wrong
-                DEBUG_LEVEL(DEBUG_BASIC, NTPSYNC_DBG("%s", "-- Invalid timestamp\n"));
-                _error(pNtp, eNtpSyncError_unexpected);
-                break;
-            }
-            else
-            if (xmt == packet.transmit_ts) { // check for duplicate or replay
-                DEBUG_LEVEL(DEBUG_BASIC, NTPSYNC_DBG("%s", "-- Duplicate or replay: ignore\n"));
-                ignore++;
-            }
-            else
-            if (org == packet.transmit_ts) { // check for bogus
-                DEBUG_LEVEL(DEBUG_BASIC, NTPSYNC_DBG("%s", "-- Bogus: ignore\n"));
-                ignore++;
-            }
-            else
-            if (LI(&packet) == NOSYNC || STRATUM(&packet) >= MAXSTRAT || STRATUM(&packet) == 0) {
-                DEBUG_LEVEL(DEBUG_BASIC, NTPSYNC_DBG("%s", "-- Unsynchronised source\n"));
-                ignore++;
-            }
-            else
-            if (FP2D(packet.rootdelay) / 2 + FP2D(packet.rootdisp) >= MAXDISP || packet.reference_ts > packet.transmit_ts) {
-                DEBUG_LEVEL(DEBUG_BASIC, NTPSYNC_DBG("%s", "-- Invalid header values\n"));
-                ignore++;
-            }
-            rec = packet.receive_ts;
-            org = packet.origin_ts = packet.transmit_ts;
-
-            if (!ignore) {
-                double t1, t2, t3, t4;
-
-                t1 = LFP2D(LFP70(xmt));
-                t2 = LFP2D(LFP70(pbuf[i].receive_ts));
-                t3 = LFP2D(LFP70(pbuf[i].transmit_ts));
-                t4 = LFP2D(LFP70(packet.receive_ts));
-
-                ts[i].offset = (t2 - t1 + t3 - t4) / 2;
-                ts[i].delay  = (t4 - t1) - (t3 - t2);
-                ts[i].dispersion = LOG2D((signed char)PRECISION(&packet)) + LOG2D(CKPRECISION) + PHI*LFP2D(packet.receive_ts - pbuf[i].origin_ts);
-
-                DEBUG_LEVEL(DEBUG_DEEP, NTPSYNC_DBG("-- Packet %d: relative offset = %f, delay = %f, dispersion = %f, (%f, %f, %f ,%f)\n", i, ts[i].offset, ts[i].delay, ts[i].dispersion, t1, t2, t3, t4));
-
-                i = (i + 1) % NTP_PKT_BUF_SZ;
-
-                if (i == 0) { // adjust the clock every NTP_PKT_BUF_SZ packets received
-                    max_offset = pNtp->time.adjustements == 0 ? 0 : pNtp->max_offset;
-                    _adjust_clock(&pNtp->time, ts, max_offset);
-                    last_sync = LOC_2_NTP(&pNtp->time, pNtp->time.tsync_sys);
-
-                    if (ABS(pNtp->time.ofs_rel) < pNtp->max_offset)
-                        pNtp->synchronised = 1;
-                    else
-                    if (pNtp->time.adjustements > 2 || pNtp->synchronised) {
-                        DEBUG_LEVEL(DEBUG_BASIC, NTPSYNC_DBG("-- Cannot synchronise: current relative offset = %f\n", pNtp->time.ofs_rel));
-                        _error(pNtp, eNtpSyncError_accuracy_broken);
-                        break;
-                    }
+    // the next requests echo this reply
+    pPeer->last = packet;
+    pPeer->last.receive_ts = LOC_2_NTP(&pNtp->time, recv_ts);
+    pPeer->last.origin_ts = packet.transmit_ts;
+
+    for (pPeer->n_req--; i < pPeer->n_req; i++)
+        pPeer->req[i] = pPeer->req[i + 1];
+}
+
+// A burst collects NTP_PKT_BUF_SZ samples from all the servers at once, keeping up to burst_depth requests in
+// flight to each one, spaced by BURST_SPACING: it takes about one round trip (of the slowest server) plus the
+// spacings, instead of NTP_PKT_BUF_SZ round trips per server.
+// The replies are matched to the requests by their origin timestamp, so that a late reply of a previous
+// request, or a duplicate, is discarded. A server failing is left out of the burst.
+static void _burst_begin(tNtpTime *pNtp, int64_t now) {
+    tNtpPeer *p;
+    int i;
+
+    for (i = 0; i < pNtp->n_peers; i++) {
+        p = &pNtp->peers[i];
+        p->n = p->n_req = p->ignored = 0;
+        p->fresh = 0;
+        p->next_send = 0;
+        p->error = p->disabled ? p->error : eNtpSyncError_no;
+    }
+
+    pNtp->burst_start = now;
+    pNtp->bursting = 1;
+}
+
+// Send the requests due and leave out the servers whose reply is late: returns when the burst needs to
+// be looked at again (if no reply comes before), 0 when no server is left in it
+static int64_t _burst_send(tNtpTime *pNtp, int64_t now) {
+    int64_t deadline = now + BURST_TIMEOUT;
+    int i, active;
+    tNtpPeer *p;
+
+    for (i = active = 0; i < pNtp->n_peers; i++) {
+        p = &pNtp->peers[i];
+
+        if (p->error != eNtpSyncError_no || p->n + p->ignored == NTP_PKT_BUF_SZ)
+            continue;
+
+        // never more requests in flight than the replies still missing
+        if (p->n_req < pNtp->burst_depth && p->n + p->ignored + p->n_req < NTP_PKT_BUF_SZ) {
+            if (now >= p->next_send) {
+                if (_ntp_send(pNtp, p, pNtp->last_sync, &p->req[p->n_req]) != 0) {
+                    _peer_fail(p, eNtpSyncError_send);
+                    continue;
                 }
-            }
+                p->n_req++;
+                p->next_send = now + BURST_SPACING;
 
-            if (i == 0 && !ignore) {
-                delay = (GETSECS() - delay) * 1000000; // usecs
-                DEBUG_LEVEL(DEBUG_MEDIUM, NTPSYNC_DBG("-- Sleeping for %d us\n", inter_sync_delay - (int)delay));
-                if (inter_sync_delay - delay >= 0)
-                    _USLEEP_COND(inter_sync_delay - (int)delay, 1000000, pNtp->stop); // sleep but also check for exit condition
-                inter_sync_delay = inter_sync_delay * 2 > pNtp->inter_sync_delay*1000 ? pNtp->inter_sync_delay*1000 : inter_sync_delay * 2;
+                if (p->tx_timestamps)
+                    _ntp_tx_timestamps(p);
             }
+            deadline = MIN(deadline, p->next_send);
+        }
 
+        if (p->n_req > 0) {
+            if (now - p->req[0].send_ts[1] >= BURST_TIMEOUT) {
+                DEBUG_LEVEL(DEBUG_BASIC, NTPSYNC_DBG("-- Reply from %s not received\n", p->host));
+                _peer_fail(p, eNtpSyncError_receive);
+                continue;
+            }
+            deadline = MIN(deadline, p->req[0].send_ts[1] + BURST_TIMEOUT);
         }
+        active++;
     }
-    DEBUG_LEVEL(DEBUG_MEDIUM, NTPSYNC_DBG("%s", "-- Quitted\n"));
-    return NULL;
+    return active > 0 ? deadline : 0;
 }
 
-//---- The timer implementation
+// 0 when at least one server replied to all the requests, with some samples
+// How much an error of a server tells: what a server answered, over what failed on the way, over silence
+static int _error_rank(eNtpSyncError e) {
+
+    switch (e) {
+        case eNtpSyncError_kod:             return 5;
+        case eNtpSyncError_version:
+        case eNtpSyncError_unexpected:      return 4;
+        case eNtpSyncError_unsynchronised:  return 3;
+        case eNtpSyncError_send:            return 2;
+        case eNtpSyncError_receive:         return 1;
+        default:                            return 0;
+    }
+}
 
-#define NTP_SRV_PORT 123
+static int _burst_end(tNtpTime *pNtp, int64_t now) {
+    uint64_t outliers_offset = 0, outliers_delay = 0;
+    eNtpSyncError err = eNtpSyncError_receive, e;
+    int i, reached, complete = 0;
+    tNtpPeer *p;
+
+    pNtp->bursting = 0;
+    FLAG_SET(pNtp->burst_duration, now - pNtp->burst_start);
+    DEBUG_LEVEL(DEBUG_MEDIUM, NTPSYNC_DBG("-- Burst of %d samples (%d in flight) from %d servers in %.6f s\n", NTP_PKT_BUF_SZ, pNtp->burst_depth, pNtp->n_peers, NS2D(FLAG_GET(pNtp->burst_duration))));
+
+    for (i = 0; i < pNtp->n_peers; i++) {
+        p = &pNtp->peers[i];
+        reached = p->n > 0 && p->n + p->ignored == NTP_PKT_BUF_SZ;
+        p->reach = (p->reach << 1) | reached;
+        complete += reached;
+        e = p->error != eNtpSyncError_no ? p->error : p->ignored > 0 ? eNtpSyncError_unsynchronised : eNtpSyncError_receive;
+        err = _error_rank(e) > _error_rank(err) ? e : err;
+        outliers_offset += p->gate.rejected_offset;
+        outliers_delay += p->gate.rejected_delay;
+    }
+
+    FLAG_SET(pNtp->outliers_offset, outliers_offset);
+    FLAG_SET(pNtp->outliers_delay, outliers_delay);
 
-static pthread_t s_sync_thread;
-static tNtpTime s_ntp_sync;
+    if (complete == 0) { // the most telling of the errors of the servers
+        _error(pNtp, err);
+        return 1;
+    }
+    return 0;
+}
 
-#define _Get_Millisec() (SLEWED_UNIX_TIME(&s_ntp_sync.time) * 1000)
+#define NS_SHORT(a)     ((int64_t)(a) * NSECS_PER_SEC / TWO_E16)   // NTP short to [ns]
 
-void ntp_sync_stop() {
+// Root distance of a peer at the local time now: half the round trip to the reference clock plus the
+// dispersion accumulated along the way, the one of its samples (aged up to now) and their jitter
+static void _peer_update(tNtpPeer *pPeer, int64_t now) {
+    tNtpFilter *f = &pPeer->filter;
+
+    pPeer->offset = ntp_huffpuff_correct(&pPeer->huffpuff, f->offset, f->delay);
+    pPeer->distance = MAX(NTP_SELECT_MINDISP, NS_SHORT(pPeer->last.rootdelay) + f->delay) / 2 + NS_SHORT(pPeer->last.rootdisp) + ntp_filter_dispersion(f, now) + f->jitter;
 
-    if (s_ntp_sync.inited) {
-        s_ntp_sync.stop = 1;
-        pthread_join(s_sync_thread, NULL);
-        udp_close(s_ntp_sync.comm);
+    DEBUG_LEVEL(DEBUG_MEDIUM, NTPSYNC_DBG("-- Server %s:%d: offset = %.9f (%+.9f), delay = %.9f, jitter = %.9f, distance = %.9f, %s sample, %llu spikes\n", pPeer->host, pPeer->port, NS2D(pPeer->offset), NS2D(pPeer->offset - f->offset), NS2D(f->delay), NS2D(f->jitter), NS2D(pPeer->distance), pPeer->fresh ? "new" : "old", (unsigned long long)f->spikes));
+}
+
+// Select, cluster and combine the servers reached in the last bursts (rfc5905): 0 if there is a system offset.
+// The clock is only updated on a new sample of the system peer: the others may contribute their old ones.
+static int _ntp_mitigate(tNtpTime *pNtp, int64_t *pOffset, int64_t *pDelay, int64_t *pJitter) {
+    tNtpCandidate cand[NTP_MAX_PEERS];
+    int idx[NTP_MAX_PEERS];
+    int64_t now = GETNSECS();
+    int i, n = 0, sys;
+
+    for (i = 0; i < pNtp->n_peers; i++) {
+        tNtpPeer *p = &pNtp->peers[i];
+
+        if (p->filter.t == 0 || (p->reach & 0x7) == 0)
+            continue;
+
+        _peer_update(p, now);
+        cand[n].offset = p->offset;
+        cand[n].distance = p->distance;
+        cand[n].jitter = p->filter.jitter;
+        cand[n].stratum = STRATUM(&p->last);
+        idx[n++] = i;
     }
 
-    if (s_ntp_sync.error)
-        DEBUG_LEVEL(DEBUG_BASIC, NTPSYNC_DBG("%s","-- An NTP synchronisation occurred.\nTimestamps are not reliable\n"));
+    if (ntp_select(cand, n) == 0) {
+        DEBUG_LEVEL(DEBUG_BASIC, NTPSYNC_DBG("-- No agreement among %d servers: clock not adjusted\n", n));
+        pNtp->no_majority++;
+        return 1;
+    }
+    pNtp->no_majority = 0;
 
-    s_ntp_sync.inited = 0;
+    ntp_cluster(cand, n);
+
+    for (i = 0; i < n; i++)
+        pNtp->peers[idx[i]].survivor = cand[i].survivor;
+
+    if ((sys = ntp_combine(cand, n, pOffset, pJitter)) < 0)
+        return 1;
+
+    if (!pNtp->peers[idx[sys]].fresh) {
+        DEBUG_LEVEL(DEBUG_MEDIUM, NTPSYNC_DBG("-- No new sample from the system peer %s:%d: clock not adjusted\n", pNtp->peers[idx[sys]].host, pNtp->peers[idx[sys]].port));
+        return 1;
+    }
+
+    *pDelay = pNtp->peers[idx[sys]].filter.delay;
+    FLAG_SET(pNtp->huffpuff_correction, pNtp->peers[idx[sys]].offset - pNtp->peers[idx[sys]].filter.offset);
+    FLAG_SET(pNtp->huffpuff_min_delay, pNtp->peers[idx[sys]].huffpuff.min_delay);
+    DEBUG_LEVEL(DEBUG_MEDIUM, NTPSYNC_DBG("-- System peer %s:%d: combined offset = %.9f, jitter = %.9f\n", pNtp->peers[idx[sys]].host, pNtp->peers[idx[sys]].port, NS2D(*pOffset), NS2D(*pJitter)));
+    return 0;
 }
 
-void ntp_sync_set_time(double ms) {
-    // Here: measure the time this operation costs...
-    s_ntp_sync.ntp_start_time = (tstamp)((uint64_t)SLEWED_NTP_TIME(&s_ntp_sync.time) - D2LFP(ms/1000));
-	s_ntp_sync.start_time = LFP2D(LFP70(s_ntp_sync.ntp_start_time)) * 1000;
+#define STATE_SAVE_INTERVAL 64000000000LL       // the state is saved at most this often while synchronised [ns]
+#define STATE_MAX_AGE       86400000000000LL    // the frequency of an older state is not trusted [ns]
+#define STATE_SUSPEND_MIN   1000000LL           // the shortest suspension told from the kernel slew of CLOCK_BOOTTIME [ns]
+#define STATE_SKEW_SD_MIN   1000.               // the saved frequency is not known better than 1 ppm by the Kalman filter [ns/s]
+
+static void _state_save(tNtpTime *pNtp) {
+    tNtpStatePeer *sp;
+    tNtpState s;
+    tNtpPeer *p;
+    int i;
+
+    memset(&s, 0, sizeof(tNtpState));
+    s.local = GETNSECS();
+    s.time = LOC_2_UNIX(&pNtp->time, s.local);
+    s.freq = pNtp->time.freq;
+    s.wander = pNtp->time.wander;
+    s.poll = pNtp->poll;
+
+    for (i = 0; i < pNtp->n_peers && s.n_peers < NTP_STATE_PEERS; i++) {
+        p = &pNtp->peers[i];
+
+        if (p->filter.t == 0)
+            continue;
+
+        sp = &s.peers[s.n_peers++];
+        snprintf(sp->host, sizeof(sp->host), "%s", p->host);
+        sp->port = p->port;
+        sp->min_delay = MIN(p->filter.delay, p->huffpuff.min_delay);
+        sp->jitter = p->filter.jitter;
+    }
+
+    pNtp->state_saved = s.local; // a failed save is tried again at the next interval, not at every update
+    if (ntp_state_save(pNtp->state_file, &s) != 0)
+        DEBUG_LEVEL(DEBUG_BASIC, NTPSYNC_DBG("-- Failed to save the state to %s\n", pNtp->state_file));
 }
 
-int ntp_sync_start(char *ip_address, double max_offset_ms, int inter_sync_delay_ms) {
-    int rc = 1;
+// Warm start from the state saved by a previous run, within this boot. The frequency of the local clock
+// holds for a while. The time the local clock kept holds as long as the wander of the frequency cannot
+// have moved it by max_offset, and only if the system was not suspended meanwhile, since CLOCK_MONOTONIC_RAW
+// stops then while CLOCK_BOOTTIME doesn't: the first burst taken within the jitter of the servers (plus that
+// wander) confirms it at once. The interval of the updates resumes from where it was, and the delays of the
+// servers seed their huff-n'-puff filters.
+static void _state_load(tNtpTime *pNtp) {
+    int64_t elapsed, now, drift, jitter = 0;
+    tTime *pT = &pNtp->time;
+    tNtpStatePeer *sp;
+    tNtpState s;
+    tNtpPeer *p;
+    int i, j, matched = 0, warm = 1;
+
+    if (ntp_state_load(pNtp->state_file, &s, &elapsed) != 0 || elapsed > STATE_MAX_AGE)
+        return;
+
+    now = GETNSECS();
+    pT->freq = MAX(MIN(s.freq, FREQ_MAX), -FREQ_MAX);
+    pT->wander = s.wander;
+    pT->tsync_sys = now;
+    ntp_kalman_prior(&pNtp->kalman, (double)pT->freq / TWO_E32 * NSECS_PER_SEC, MAX((double)s.wander / TWO_E32 * NSECS_PER_SEC, STATE_SKEW_SD_MIN));
+    pNtp->poll = MAX(MIN(s.poll, pNtp->inter_sync_delay * 1000000LL), pNtp->min_poll * 1000000LL);
+    FLAG_SET(pNtp->poll_ms, (int)(pNtp->poll / 1000000));
+
+    for (i = 0; i < pNtp->n_peers; i++) {
+        p = &pNtp->peers[i];
+
+        for (j = 0; j < s.n_peers; j++) {
+            sp = &s.peers[j];
+
+            if (sp->port != p->port || strncmp(sp->host, p->host, sizeof(sp->host)) != 0)
+                continue;
+
+            if (elapsed < pNtp->huffpuff_window && sp->min_delay > 0)
+                ntp_huffpuff_add(&p->huffpuff, sp->min_delay, now);
+            jitter = MAX(jitter, sp->jitter);
+            matched++;
+            break;
+        }
+    }
 
-    if (inter_sync_delay_ms * 1000 <= INTER_SYNC_DELAY_MIN) {
-        DEBUG_LEVEL(DEBUG_BASIC, NTPSYNC_DBG("-- Inter synchronisation delay must be > %d ms\n", INTER_SYNC_DELAY_MIN/1000));
-        goto quit;
+    drift = ntp_sync_mul_q32(elapsed, s.wander);
+
+    if (ABS(elapsed - (now - s.local)) < STATE_SUSPEND_MIN + ntp_sync_mul_q32(elapsed, FREQ_MAX) && drift < pNtp->max_offset) {
+        pT->offset = s.time + (now - s.local) + ntp_sync_mul_q32(now - s.local, s.freq) - LOC_2_UNIX(pT, now);
+        pNtp->warm_band = matched > 0 ? MIN(POLL_PGATE * jitter + drift, pNtp->max_offset) : 0;
+        warm = 2;
     }
 
-    memset(&s_ntp_sync, 0 , sizeof(s_ntp_sync));
-    s_ntp_sync.comm = udp_open(ip_address, NTP_SRV_PORT, 500000);
+    FLAG_SET(pNtp->warm_start, warm);
+    DEBUG_LEVEL(DEBUG_MEDIUM, NTPSYNC_DBG("-- Warm start from a state %.3f s old: freq = %.3f ppm, poll = %.3f s, %s, %d servers known\n", NS2D(elapsed), (double)pT->freq / TWO_E32 * 1000000, NS2D(pNtp->poll), warm > 1 ? "time carried over" : "time not carried over", matched));
+}
 
-    if (s_ntp_sync.comm <= 0) {
-        DEBUG_LEVEL(DEBUG_BASIC, NTPSYNC_DBG("-- Failed to init the UDP connection with %s:%d\n", ip_address, NTP_SRV_PORT));
-        goto quit;
+static void _sync_init(tNtpTime *pNtp) {
+    int i;
+
+    _init_time(&pNtp->time, pNtp->clock_source);
+    ntp_kalman_init(&pNtp->kalman);
+    pNtp->last_sync = 0;
+    pNtp->poll = (int64_t)pNtp->min_poll * 1000000;
+    pNtp->bursting = 0;
+    pNtp->next_burst = 0;
+
+    for (i = 0; i < pNtp->n_peers; i++) {
+        memset(&pNtp->peers[i].last, 0, NTP_PACKET_SIZE);
+        ntp_filter_init(&pNtp->peers[i].filter, (int64_t)(LOG2D(CKPRECISION) * NSECS_PER_SEC));
+        ntp_huffpuff_init(&pNtp->peers[i].huffpuff, pNtp->huffpuff_window);
+        ntp_gate_init(&pNtp->peers[i].gate, pNtp->gate_k, (int64_t)(LOG2D(CKPRECISION) * NSECS_PER_SEC));
+        pNtp->peers[i].survivor = 1;
     }
 
-    s_ntp_sync.inited = 1;
-    s_ntp_sync.max_offset = max_offset_ms / 1000;
-    s_ntp_sync.inter_sync_delay = inter_sync_delay_ms;
+    if (pNtp->state_file != NULL)
+        _state_load(pNtp);
+    _clock_publish(pNtp->page, &pNtp->time);
+}
+
+#define SELECT_TRIES    4                   // updates in a row without a majority of the servers, before giving up
+#define IBURST_TRIES    4                   // tight bursts of the start, before the polls take over
+#define IBURST_GAP      20000000LL          // in between them [ns]
 
-    if (pthread_create(&s_sync_thread, NULL, _ntp_sync, &s_ntp_sync) != 0) {
-        udp_close(s_ntp_sync.comm);
-        DEBUG_LEVEL(DEBUG_BASIC, NTPSYNC_DBG("%s", "-- Failed to start the timer\n"));
-        goto quit;
+// Adjust the clock on the samples of the burst just ended, and set when the next one is due:
+// 0 on success, 1 if the synchronisation cannot go on
+static int _ntp_update(tNtpTime *pNtp) {
+    int64_t max_offset, offset = 0, ofs_delay, jitter = 0;
+    int i, adjusted;
+
+    // adjust the clock when the filters provide a new offset
+    if ((adjusted = _ntp_mitigate(pNtp, &offset, &ofs_delay, &jitter) == 0)) {
+        tNtpKalman *pKalman = pNtp->discipline == eNtpSyncDiscipline_kalman && pNtp->kalman.t != 0 ? &pNtp->kalman : NULL;
+
+        if (pKalman != NULL) { // the estimate takes the place of the combined offset
+            int64_t now = GETNSECS();
+
+            offset = ntp_kalman_offset(pKalman, now) - (pNtp->time.offset + FREQ_OFS(&pNtp->time, now));
+            DEBUG_LEVEL(DEBUG_MEDIUM, NTPSYNC_DBG("-- Estimated offset = %.9f, skew = %.3f ppm after %llu samples\n", NS2D(offset), pKalman->skew / 1000, (unsigned long long)pKalman->updates));
+        }
+
+        max_offset = pNtp->time.adjustements == 0 ? 0 : pNtp->max_offset;
+        _adjust_clock(&pNtp->time, pNtp->page, offset, ofs_delay, max_offset, pKalman);
+
+        for (i = 0; i < pNtp->n_peers; i++) {
+            ntp_gate_slew(&pNtp->peers[i].gate, offset);
+            ntp_filter_slew(&pNtp->peers[i].filter, offset);
+        }
+
+        _calibrate_clocks(&pNtp->time);
+        _clock_publish(pNtp->page, &pNtp->time);
+        pNtp->last_sync = LOC_2_NTP(&pNtp->time, pNtp->time.tsync_sys);
+
+        // with iburst, the first step is only trusted once the following burst confirms it, or if the warm start predicted it
+        if (ABS(pNtp->time.ofs_rel) < pNtp->max_offset && (pNtp->iburst == 0 || pNtp->time.adjustements > 1 || ABS(pNtp->time.ofs_rel) < pNtp->warm_band)) {
+            _clock_synchronised(pNtp->page, 1);
+
+            if (!FLAG_GET(pNtp->synchronised)) {
+                FLAG_CAS(pNtp->start_time_ns, 0, ntp_sync_page_time_ns(pNtp->page)); // unless ntp_sync_set_time set it already
+
+                FLAG_SET(pNtp->start_latency, GETNSECS() - pNtp->start_t);
+                FLAG_SET(pNtp->synchronised, 1);
+                pNtp->iburst = 0;
+                _ready(pNtp);
+                DEBUG_LEVEL(DEBUG_MEDIUM, NTPSYNC_DBG("-- Synchronised %.6f s after the start\n", NS2D(FLAG_GET(pNtp->start_latency))));
+            }
+        }
+        else
+        if (pNtp->time.adjustements > 2 || FLAG_GET(pNtp->synchronised)) {
+            DEBUG_LEVEL(DEBUG_BASIC, NTPSYNC_DBG("-- Cannot synchronise: current relative offset = %.9f\n", NS2D(pNtp->time.ofs_rel)));
+            _error(pNtp, eNtpSyncError_accuracy_broken);
+            return 1;
+        }
+        pNtp->warm_band = 0;
     }
 
-    while(!s_ntp_sync.synchronised && !s_ntp_sync.error)
-        usleep(500000);
+    if (pNtp->no_majority >= SELECT_TRIES) {
+        DEBUG_LEVEL(DEBUG_BASIC, NTPSYNC_DBG("-- No agreement among the servers for %d updates\n", pNtp->no_majority));
+        _error(pNtp, eNtpSyncError_select);
+        return 1;
+    }
 
-    if (s_ntp_sync.error) {
-        DEBUG_LEVEL(DEBUG_BASIC, NTPSYNC_DBG("%s", "-- NTP synchronisation error\n"));
-    } else {
-        ntp_sync_set_time(0);
-        rc = 0;
+    if (pNtp->iburst > 0) { // still starting: the next burst follows at once, the interval is left as it is
+        pNtp->iburst--;
+        pNtp->next_burst = GETNSECS() + IBURST_GAP;
+        return 0;
     }
 
-quit:
-    return rc;
+    pNtp->poll = _adjust_poll(pNtp, pNtp->poll, adjusted, offset, jitter);
+    pNtp->next_burst = pNtp->burst_start + pNtp->poll;
+
+    // on a loop, the fsyncs of the save would hold all its instances: the state goes at the stop only
+    if (pNtp->state_file != NULL && !pNtp->on_loop && FLAG_GET(pNtp->synchronised) && (pNtp->state_saved == 0 || pNtp->burst_start - pNtp->state_saved >= STATE_SAVE_INTERVAL))
+        _state_save(pNtp);
+    return 0;
 }
 
-double ntp_sync_get_time() {
-    return _Get_Millisec() - s_ntp_sync.start_time;
+// Move the synchronisation on at the local time now, with the replies received so far: returns the local time
+// it is to be called again at (or as soon as a reply comes), -1 when it ended on an error
+static int64_t _ntp_step(tNtpTime *pNtp, int64_t now) {
+    int64_t deadline;
+
+    if (!pNtp->bursting) {
+        if (now < pNtp->next_burst)
+            return pNtp->next_burst;
+        _burst_begin(pNtp, now);
+    }
+
+    if ((deadline = _burst_send(pNtp, now)) > 0)
+        return deadline;
+
+    if (_burst_end(pNtp, now) != 0 || _ntp_update(pNtp) != 0)
+        return -1;
+
+    DEBUG_LEVEL(DEBUG_MEDIUM, NTPSYNC_DBG("-- Sleeping for %lld us\n", (long long)(pNtp->next_burst - GETNSECS()) / 1000));
+    return pNtp->next_burst;
 }
 
-double ntp_sync_start_time() {
-    return s_ntp_sync.start_time;
+#define STOP_CHECK      1000000000LL    // the sync thread looks at the stop flag at least this often [ns]
+
+static void *_ntp_sync(void *prm) {
+    tNtpTime *pNtp = (tNtpTime *)prm;
+    int comm[NTP_MAX_PEERS], ready[NTP_MAX_PEERS], map[NTP_MAX_PEERS];
+    int64_t deadline;
+    int i, n;
+
+    DEBUG_LEVEL(DEBUG_MEDIUM, NTPSYNC_DBG("%s", "-- Started\n"));
+    _sync_init(pNtp);
+
+    while(!FLAG_GET(pNtp->stop)) {
+        if ((deadline = _ntp_step(pNtp, GETNSECS())) < 0)
+            break;
+
+        // the replies out of a burst are read and discarded
+        for (i = n = 0; i < pNtp->n_peers; i++) {
+            if (!pNtp->peers[i].disabled) {
+                comm[n] = pNtp->peers[i].comm;
+                map[n++] = i;
+            }
+        }
+
+        if (udp_wait_any(comm, n, (int)(MAX(MIN(deadline - GETNSECS(), STOP_CHECK), 0) / 1000), ready) < 0) {
+            _error(pNtp, eNtpSyncError_receive);
+            break;
+        }
+
+        for (i = 0; i < n; i++) {
+            if (ready[i])
+                _peer_receive(pNtp, &pNtp->peers[map[i]]);
+        }
+    }
+    DEBUG_LEVEL(DEBUG_MEDIUM, NTPSYNC_DBG("%s", "-- Quitted\n"));
+    return NULL;
 }
 
-int ntp_sync_error() {
-    return s_ntp_sync.error;
+//---- The timer implementation
+
+#define NTP_SRV_PORT 123
+#define NTPSYNC_TB_CACHES   8   // instances a reader thread keeps a copy of the timebase of, the default included
+#define NTPSYNC_TB_SHARED   NTPSYNC_TB_CACHES // the cache of the instances beyond: they evict each other
+
+// Settings of an instance: they apply at the next start
+typedef struct {
+    eNtpSyncClock clock_source;
+    eNtpSyncDiscipline discipline;
+    int burst_depth;
+    int tx_timestamps;
+    int min_poll;           // [ms]
+    int huffpuff_window;    // [s]
+    double gate_k;          // [MADs]
+    int iburst;
+    char page_name[NAME_MAX];
+    char state_file[PATH_MAX];
+    tCbOnReady cb_ready;
+    void *cb_ready_prm;
+} tNtpSyncConfig;
+
+#define NTPSYNC_CONFIG_DEFAULT { eNtpSyncClock_raw, eNtpSyncDiscipline_fll, NTP_PKT_BUF_SZ, 0, INTER_SYNC_DELAY_MIN / 1000, 0, 5, 0, "", "", NULL, NULL }
+
+// What an event of a loop is about: a server of an instance, or its timer (peer < 0)
+typedef struct {
+    struct tNtpSync *h;
+    int peer;
+} tNtpSyncEvent;
+
+struct tNtpSync {
+    tNtpTime ntp;
+    tNtpSyncPage local_page CACHE_ALIGNED; // the timebase when not shared, and after the stop
+    tNtpSyncPage *retired_page; // shared page of the last run: mapped until the next start, readers may still hold it
+    int page_fd;            // of the shared page, locked while this writes it: -1 if none
+    pthread_t thread;
+    tNtpSyncConfig cfg;
+    int slot;               // of the timebase caches of the reader threads
+
+    // -- when started on a loop, under its lock: on its own line, away from page and slot which the readers load
+    tNtpSyncLoop *loop CACHE_ALIGNED;
+    int timer;              // timerfd of the next step, -1 once out of the loop
+    int due;                // its step is pending, within ntp_sync_process
+    struct tNtpSync *next_due;
+    tNtpSyncEvent ev[NTP_MAX_PEERS + 1];
+};
+
+struct tNtpSyncLoop {
+    int epfd;               // the sockets and the timers of the instances
+    int wake;               // eventfd stopping the thread of the loop
+    pthread_mutex_t lock;   // the instances start and stop while the loop runs
+    pthread_t thread;
+    int running;
+    int stop;
+};
+
+// The instance of the functions without a handle: the readers see it as they saw the former globals
+static tNtpSync s_default = { .ntp = { .page = &s_default.local_page }, .cfg = NTPSYNC_CONFIG_DEFAULT, .page_fd = -1, .timer = -1 };
+static pthread_mutex_t s_slots_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int s_slots = 1;    // of the timebase caches, in use: the first is the one of the default instance
+
+// Each reader thread keeps its own copy of the timebase, of a few instances
+static __thread tNtpSyncTbCache s_tb_cache[NTPSYNC_TB_CACHES + 1];
+
+// A cache of its own for the instance, while there is one free: NTPSYNC_TB_SHARED otherwise
+static int _slot_take() {
+    int i;
+
+    pthread_mutex_lock(&s_slots_lock);
+    for (i = 0; i < NTPSYNC_TB_CACHES && (s_slots & (1U << i)); i++)
+        ;
+    if (i < NTPSYNC_TB_CACHES)
+        s_slots |= 1U << i;
+    pthread_mutex_unlock(&s_slots_lock);
+
+    if (i == NTPSYNC_TB_SHARED)
+        DEBUG_LEVEL(DEBUG_MEDIUM, NTPSYNC_DBG("-- More than %d instances: the readers of the next ones are slower\n", NTPSYNC_TB_CACHES));
+    return i;
 }
 
-void ntp_sync_on_error(tCbOnErr cb, void *prm) {
-    s_ntp_sync.cb_err = cb;
-    s_ntp_sync.cb_err_prm = prm;
+static void _slot_give(int slot) {
+
+    if (slot == NTPSYNC_TB_SHARED)
+        return;
+
+    pthread_mutex_lock(&s_slots_lock);
+    s_slots &= ~(1U << slot);
+    pthread_mutex_unlock(&s_slots_lock);
 }
 
-double ntp_sync_monotonic_time() {
-    return GETSECS() * 1000;
+static inline const tNtpSyncTimebase *_get_timebase(tNtpSync *h) {
+    return ntp_sync_page_cached(FLAG_GET(h->ntp.page), &s_tb_cache[h->slot]);
+}
+
+static inline int64_t _get_nanosec(tNtpSync *h) {
+    const tNtpSyncTimebase *tb = _get_timebase(h);
+
+    return SLEWED_LOC_2_UNIX(tb, TB_NSECS(tb));
+}
+
+// Global atomic max: a reader never returns less than what any other one has already returned
+static inline int64_t _get_nanosec_monotonic(tNtpSync *h) {
+    int64_t t = _get_nanosec(h);
+    int64_t floor = __atomic_load_n(&h->ntp.floor_ns, __ATOMIC_ACQUIRE);
+
+    while (t > floor) {
+        if (__atomic_compare_exchange_n(&h->ntp.floor_ns, &floor, t, 1, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            return t;
+    }
+
+    if (t < floor)
+        __atomic_fetch_add(&h->ntp.clamped, 1, __ATOMIC_RELAXED);
+    return floor;
+}
+
+static inline int64_t _read_timebase(tNtpSync *h, tNtpSyncTimebase *tb) {
+    return ntp_sync_page_read(FLAG_GET(h->ntp.page), tb);
+}
+
+static void _close_peers(tNtpTime *pNtp) {
+    int i;
+
+    for (i = 0; i < pNtp->n_peers; i++)
+        udp_close(pNtp->peers[i].comm);
+    pNtp->n_peers = 0;
+}
+
+// Open a socket to each server of the comma separated list of host[:port]
+static int _open_peers(tNtpTime *pNtp, char *servers, int tx_timestamps) {
+    char list[NTP_MAX_PEERS * NAME_MAX], *save, *item, *sep;
+    tNtpPeer *p;
+
+    snprintf(list, sizeof(list), "%s", servers);
+
+    for (item = strtok_r(list, ", ", &save); item != NULL; item = strtok_r(NULL, ", ", &save)) {
+        if (pNtp->n_peers == NTP_MAX_PEERS) {
+            DEBUG_LEVEL(DEBUG_BASIC, NTPSYNC_DBG("-- More than %d servers: %s and the following ones ignored\n", NTP_MAX_PEERS, item));
+            break;
+        }
+
+        p = &pNtp->peers[pNtp->n_peers];
+        snprintf(p->host, sizeof(p->host), "%s", item);
+        p->port = NTP_SRV_PORT;
+
+        if ((sep = strrchr(p->host, ':')) != NULL) {
+            *sep = '\0';
+            p->port = atoi(sep + 1);
+        }
+
+        p->comm = udp_open(p->host, p->port, 500000);
+
+        if (p->comm <= 0) {
+            DEBUG_LEVEL(DEBUG_BASIC, NTPSYNC_DBG("-- Failed to init the UDP connection with %s:%d\n", p->host, p->port));
+            _close_peers(pNtp);
+            return 1;
+        }
+        pNtp->n_peers++;
+
+        if (udp_set_rx_timestamps(p->comm) != 0)
+            DEBUG_LEVEL(DEBUG_BASIC, NTPSYNC_DBG("-- Kernel receive timestamps not available for %s\n", p->host));
+
+        if (tx_timestamps && !(p->tx_timestamps = udp_set_tx_timestamps(p->comm) == 0))
+            DEBUG_LEVEL(DEBUG_BASIC, NTPSYNC_DBG("-- Kernel transmit timestamps not available for %s\n", p->host));
+    }
+
+    if (pNtp->n_peers == 0) {
+        DEBUG_LEVEL(DEBUG_BASIC, NTPSYNC_DBG("-- No server in \"%s\"\n", servers));
+        return 1;
+    }
+    return 0;
+}
+
+//---- The event loop: the instances started on it are stepped on the replies of their servers and on their
+// timer, one epoll set for all of them. The loop is driven by ntp_sync_process, on its own thread or not.
+
+#define LOOP_EVENTS     64      // handled per epoll_wait
+
+#ifdef __linux__
+
+// Take the instance out of the loop, lock held
+static void _loop_detach(tNtpSync *h) {
+    int i;
+
+    if (h->timer < 0)
+        return;
+
+    for (i = 0; i < h->ntp.n_peers; i++)
+        epoll_ctl(h->loop->epfd, EPOLL_CTL_DEL, h->ntp.peers[i].comm, NULL);
+
+    epoll_ctl(h->loop->epfd, EPOLL_CTL_DEL, h->timer, NULL);
+    close(h->timer);
+    h->timer = -1;
+}
+
+// Step the instance and arm its timer to the next step, lock held: the callbacks of the step are
+// appended to calls, to be called once the lock is released. Returns how many.
+static int _loop_step(tNtpSync *h, tNtpSyncCall *calls) {
+    struct itimerspec its;
+    int64_t next;
+    int n;
+
+    h->ntp.calls = calls;
+    h->ntp.n_calls = 0;
+    next = _ntp_step(&h->ntp, GETNSECS());
+    n = h->ntp.n_calls;
+    h->ntp.calls = NULL;
+
+    if (next < 0) { // the synchronisation ended, as its thread would have: the timebase stays
+        _loop_detach(h);
+        return n;
+    }
+
+    next = MAX(next - GETNSECS(), 1); // 0 would disarm it
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = next / NSECS_PER_SEC;
+    its.it_value.tv_nsec = next % NSECS_PER_SEC;
+    timerfd_settime(h->timer, 0, &its, NULL);
+    return n;
+}
+
+static int _loop_add(tNtpSync *h, int fd, int peer) {
+    struct epoll_event ev;
+
+    h->ev[peer + 1].h = h;
+    h->ev[peer + 1].peer = peer;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = &h->ev[peer + 1];
+    return epoll_ctl(h->loop->epfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+static int _loop_attach(tNtpSync *h, tNtpSyncLoop *l) {
+    tNtpSyncCall calls[CALLS_PER_STEP];
+    int i, n = 0, rc = 0;
+
+    if ((h->timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0)
+        return 1;
+
+    pthread_mutex_lock(&l->lock);
+    h->loop = l;
+
+    for (i = 0; rc == 0 && i < h->ntp.n_peers; i++)
+        rc = udp_set_nonblocking(h->ntp.peers[i].comm) != 0 || _loop_add(h, h->ntp.peers[i].comm, i) != 0;
+
+    if (rc == 0 && _loop_add(h, h->timer, -1) == 0) {
+        n = _loop_step(h, calls); // the first requests go now
+    } else {
+        _loop_detach(h);
+        h->loop = NULL;
+        rc = 1;
+    }
+
+    pthread_mutex_unlock(&l->lock);
+
+    for (i = 0; i < n; i++)
+        _call_now(&calls[i]);
+    return rc;
+}
+
+static void *_loop_run(void *prm) {
+    tNtpSyncLoop *l = (tNtpSyncLoop *)prm;
+    struct pollfd fds[2];
+
+    fds[0].fd = l->epfd;
+    fds[1].fd = l->wake;
+    fds[0].events = fds[1].events = POLLIN;
+
+    while (!FLAG_GET(l->stop)) {
+        if (poll(fds, 2, -1) < 0 && errno != EINTR) {
+            DEBUG_LEVEL(DEBUG_BASIC, NTPSYNC_DBG("-- Loop failed to wait (%d)\n", errno));
+            break;
+        }
+
+        if (fds[0].revents & POLLIN)
+            ntp_sync_process(l);
+    }
+    return NULL;
+}
+
+tNtpSyncLoop *ntp_sync_loop_create() {
+    tNtpSyncLoop *l = calloc(1, sizeof(tNtpSyncLoop));
+
+    if (l == NULL)
+        return NULL;
+
+    pthread_mutex_init(&l->lock, NULL);
+    l->epfd = epoll_create1(EPOLL_CLOEXEC);
+    l->wake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    if (l->epfd < 0 || l->wake < 0) {
+        DEBUG_LEVEL(DEBUG_BASIC, NTPSYNC_DBG("-- Failed to create the loop (%d)\n", errno));
+        ntp_sync_loop_destroy(l);
+        return NULL;
+    }
+    return l;
+}
+
+void ntp_sync_loop_destroy(tNtpSyncLoop *l) {
+    uint64_t one = 1;
+
+    if (l == NULL)
+        return;
+
+    if (l->running) {
+        FLAG_SET(l->stop, 1);
+        if (write(l->wake, &one, sizeof(one)) < 0)
+            DEBUG_LEVEL(DEBUG_BASIC, NTPSYNC_DBG("-- Failed to wake the loop up (%d)\n", errno));
+        pthread_join(l->thread, NULL);
+    }
+
+    pthread_mutex_destroy(&l->lock);
+    if (l->epfd >= 0)
+        close(l->epfd);
+    if (l->wake >= 0)
+        close(l->wake);
+    free(l);
+}
+
+int ntp_sync_loop_start(tNtpSyncLoop *l) {
+
+    if (l->running || pthread_create(&l->thread, NULL, _loop_run, l) != 0)
+        return 1;
+
+    l->running = 1;
+    return 0;
+}
+
+int ntp_sync_loop_fd(tNtpSyncLoop *l) {
+    return l->epfd;
+}
+
+int ntp_sync_process(tNtpSyncLoop *l) {
+    struct epoll_event ev[LOOP_EVENTS];
+    tNtpSync *due = NULL, *h;
+    uint64_t expired;
+    int i, n, n_due = 0, n_calls = 0, total = 0;
+
+    pthread_mutex_lock(&l->lock);
+
+    // all the replies ready first, then a step per instance: a reply waiting for its turn is not taken for lost
+    do {
+        if ((n = epoll_wait(l->epfd, ev, LOOP_EVENTS, 0)) < 0) {
+            if (errno != EINTR)
+                total = -1;
+            break;
+        }
+
+        for (i = 0; i < n; i++) {
+            tNtpSyncEvent *e = (tNtpSyncEvent *)ev[i].data.ptr;
+
+            h = e->h;
+            if (e->peer < 0) {
+                if (read(h->timer, &expired, sizeof(expired)) < 0 && errno != EAGAIN)
+                    DEBUG_LEVEL(DEBUG_BASIC, NTPSYNC_DBG("-- Failed to read the timer (%d)\n", errno));
+            } else
+                _peer_receive(&h->ntp, &h->ntp.peers[e->peer]);
+
+            if (!h->due) {
+                h->due = 1;
+                h->next_due = due;
+                due = h;
+                n_due++;
+            }
+        }
+        total += n;
+    } while (n == LOOP_EVENTS);
+
+    // the callbacks once the lock is released: they may stop (or destroy) their instance, or any other
+    {
+        tNtpSyncCall calls[n_due * CALLS_PER_STEP + 1];
+
+        for (h = due; h != NULL; h = h->next_due) {
+            h->due = 0;
+            n_calls += _loop_step(h, &calls[n_calls]);
+        }
+
+        pthread_mutex_unlock(&l->lock);
+
+        for (i = 0; i < n_calls; i++)
+            _call_now(&calls[i]);
+    }
+    return total;
+}
+
+#else
+
+static void _loop_detach(tNtpSync *h) {
+}
+
+static int _loop_attach(tNtpSync *h, tNtpSyncLoop *l) {
+    return 1;
+}
+
+tNtpSyncLoop *ntp_sync_loop_create() {
+    DEBUG_LEVEL(DEBUG_BASIC, NTPSYNC_DBG("%s", "-- Event loop not supported\n"));
+    return NULL;
+}
+
+void ntp_sync_loop_destroy(tNtpSyncLoop *l) {
+}
+
+int ntp_sync_loop_start(tNtpSyncLoop *l) {
+    return 1;
+}
+
+int ntp_sync_loop_fd(tNtpSyncLoop *l) {
+    return -1;
+}
+
+int ntp_sync_process(tNtpSyncLoop *l) {
+    return -1;
+}
+
+#endif
+
+static void _ready_init(tNtpTime *pNtp, tNtpSyncConfig *cfg) {
+    pthread_condattr_t attr;
+
+    pthread_condattr_init(&attr);
+#ifdef __linux__
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pNtp->ready_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+#else
+    pNtp->ready_fd = -1;
+#endif
+    pthread_mutex_init(&pNtp->ready_lock, NULL);
+    pthread_cond_init(&pNtp->ready_cond, &attr);
+    pthread_condattr_destroy(&attr);
+    pNtp->ready = 0;
+    pNtp->cb_ready = cfg->cb_ready;
+    pNtp->cb_ready_prm = cfg->cb_ready_prm;
+}
+
+static void _ready_close(tNtpTime *pNtp) {
+
+    if (pNtp->ready_fd >= 0)
+        close(pNtp->ready_fd);
+    pNtp->ready_fd = -1;
+}
+
+// The readers in process go on with the last timebase of the shared page, in the local one. The name of
+// the shared page goes at once, its mapping only at the next start (or at the destroy), as a reader may
+// have loaded its address just before the switch.
+static void _page_release(tNtpSync *h) {
+    tNtpSyncPage *shared = h->ntp.page;
+
+    if (shared == &h->local_page)
+        return;
+
+    _page_handover(&h->local_page, shared);
+    FLAG_SET(h->ntp.page, &h->local_page);
+    _clock_synchronised(shared, 0);
+    shm_unlink(h->cfg.page_name);
+    close(h->page_fd); // the next writer may go
+    h->page_fd = -1;
+    h->retired_page = shared;
+}
+
+static void _page_unmap(tNtpSync *h) {
+
+    if (h->retired_page != NULL)
+        munmap(h->retired_page, NTPSYNC_PAGE_SIZE);
+    h->retired_page = NULL;
+}
+
+tNtpSync *ntp_sync_create() {
+    tNtpSync *h;
+    tNtpSyncConfig cfg = NTPSYNC_CONFIG_DEFAULT;
+
+    if (posix_memalign((void **)&h, CACHE_LINE, sizeof(tNtpSync)) != 0)
+        return NULL;
+
+    memset(h, 0, sizeof(tNtpSync));
+    h->ntp.page = &h->local_page;
+    h->cfg = cfg;
+    h->page_fd = -1;
+    h->timer = -1;
+    h->slot = _slot_take();
+    return h;
+}
+
+void ntp_sync_destroy(tNtpSync *h) {
+
+    if (h == NULL || h == &s_default)
+        return;
+
+    ntp_sync_h_stop(h);
+    _page_unmap(h);
+    _slot_give(h->slot);
+    free(h);
+}
+
+tNtpSync *ntp_sync_default() {
+    return &s_default;
+}
+
+void ntp_sync_h_stop(tNtpSync *h) {
+    tNtpTime *pNtp = &h->ntp;
+
+    if (FLAG_GET(pNtp->inited)) {
+        if (h->loop != NULL) {
+            pthread_mutex_lock(&h->loop->lock);
+            _loop_detach(h);
+            pthread_mutex_unlock(&h->loop->lock);
+            h->loop = NULL;
+        } else {
+            FLAG_SET(pNtp->stop, 1);
+            pthread_join(h->thread, NULL);
+        }
+
+        if (pNtp->state_file != NULL && FLAG_GET(pNtp->synchronised) && !FLAG_GET(pNtp->error))
+            _state_save(pNtp);
+        _close_peers(pNtp);
+
+        _page_release(h);
+        _clock_synchronised(&h->local_page, 0);
+
+        pthread_mutex_lock(&pNtp->ready_lock); // nothing more is coming
+        pNtp->ready = 1;
+        pthread_cond_broadcast(&pNtp->ready_cond);
+        pthread_mutex_unlock(&pNtp->ready_lock);
+        _ready_close(pNtp);
+    }
+
+    if (FLAG_GET(pNtp->error))
+        DEBUG_LEVEL(DEBUG_BASIC, NTPSYNC_DBG("%s","-- An NTP synchronisation occurred.\nTimestamps are not reliable\n"));
+
+    FLAG_SET(pNtp->inited, 0);
+}
+
+void ntp_sync_h_set_time(tNtpSync *h, double ms) {
+    // Here: measure the time this operation costs...
+    FLAG_SET(h->ntp.start_time_ns, _get_nanosec(h) - (int64_t)(ms * 1000000));
+}
+
+// Start the synchronisation on the loop, or on a thread of its own when l is NULL: it goes on from there
+static int _start(tNtpSync *h, tNtpSyncLoop *l, char *ip_address, double max_offset_ms, int inter_sync_delay_ms) {
+    tNtpTime *pNtp = &h->ntp;
+    tNtpSyncConfig *cfg = &h->cfg;
+    int rc = 1;
+
+    if (inter_sync_delay_ms * 1000LL <= INTER_SYNC_DELAY_MIN) {
+        DEBUG_LEVEL(DEBUG_BASIC, NTPSYNC_DBG("-- Inter synchronisation delay must be > %d ms\n", INTER_SYNC_DELAY_MIN/1000));
+        goto quit;
+    }
+
+    // all but the read path, that the readers may be looking at since the last run
+    FLAG_SET(pNtp->start_time_ns, 0);
+    memset(&pNtp->time, 0, sizeof(tNtpTime) - offsetof(tNtpTime, time));
+    _page_unmap(h);
+    pNtp->clock_source = cfg->clock_source;
+    pNtp->discipline = cfg->discipline;
+    pNtp->burst_depth = cfg->burst_depth;
+    pNtp->huffpuff_window = (int64_t)cfg->huffpuff_window * NSECS_PER_SEC;
+    pNtp->gate_k = cfg->gate_k;
+    pNtp->iburst = cfg->iburst ? IBURST_TRIES : 0;
+    pNtp->start_t = GETNSECS();
+    pNtp->state_file = cfg->state_file[0] ? cfg->state_file : NULL;
+    pNtp->on_loop = l != NULL;
+    pNtp->ready_fd = -1;
+    _page_init(&h->local_page);
+
+    if (cfg->page_name[0]) {
+        tNtpSyncPage *shared = _page_create(cfg->page_name, &h->page_fd);
+
+        if (shared == NULL) {
+            DEBUG_LEVEL(DEBUG_BASIC, NTPSYNC_DBG("-- Failed to create the shared page %s\n", cfg->page_name));
+            goto quit;
+        }
+        FLAG_SET(pNtp->page, shared);
+    }
+
+    if (_open_peers(pNtp, ip_address, cfg->tx_timestamps) != 0)
+        goto quit_page;
+
+    FLAG_SET(pNtp->inited, 1);
+    pNtp->max_offset = (int64_t)(max_offset_ms * 1000000);
+    pNtp->inter_sync_delay = inter_sync_delay_ms;
+    pNtp->min_poll = MIN(cfg->min_poll, inter_sync_delay_ms);
+    pNtp->poll_ms = pNtp->min_poll;
+    _ready_init(pNtp, cfg);
+
+    if (l != NULL) {
+        _sync_init(pNtp);
+
+        if (_loop_attach(h, l) != 0) {
+            DEBUG_LEVEL(DEBUG_BASIC, NTPSYNC_DBG("%s", "-- Failed to start on the loop\n"));
+            goto quit_peers;
+        }
+    } else
+    if (pthread_create(&h->thread, NULL, _ntp_sync, pNtp) != 0) {
+        DEBUG_LEVEL(DEBUG_BASIC, NTPSYNC_DBG("%s", "-- Failed to start the timer\n"));
+        goto quit_peers;
+    }
+    return 0;
+
+quit_peers:
+    FLAG_SET(pNtp->inited, 0);
+    _close_peers(pNtp);
+    _ready_close(pNtp);
+quit_page:
+    _page_release(h);
+quit:
+    return rc;
+}
+
+int ntp_sync_h_start(tNtpSync *h, char *ip_address, double max_offset_ms, int inter_sync_delay_ms) {
+
+    if (_start(h, NULL, ip_address, max_offset_ms, inter_sync_delay_ms) != 0)
+        return 1;
+
+    if (ntp_sync_h_wait(h, -1) != 0) {
+        DEBUG_LEVEL(DEBUG_BASIC, NTPSYNC_DBG("%s", "-- NTP synchronisation error\n"));
+        return 1;
+    }
+    return 0;
+}
+
+int ntp_sync_h_start_async(tNtpSync *h, char *ip_address, double max_offset_ms, int inter_sync_delay_ms) {
+    return _start(h, NULL, ip_address, max_offset_ms, inter_sync_delay_ms);
+}
+
+int ntp_sync_h_start_on(tNtpSync *h, tNtpSyncLoop *l, char *ip_address, double max_offset_ms, int inter_sync_delay_ms) {
+    return l != NULL ? _start(h, l, ip_address, max_offset_ms, inter_sync_delay_ms) : 1;
+}
+
+int ntp_sync_h_wait(tNtpSync *h, int timeout_ms) {
+    tNtpTime *pNtp = &h->ntp;
+    struct timespec ts;
+    int rc = 0;
+
+    if (!FLAG_GET(pNtp->inited))
+        return 1;
+
+#ifdef __linux__
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#else
+    clock_gettime(CLOCK_REALTIME, &ts);
+#endif
+    ts.tv_sec += timeout_ms / 1000 + (ts.tv_nsec + (timeout_ms % 1000) * 1000000LL) / NSECS_PER_SEC;
+    ts.tv_nsec = (ts.tv_nsec + (timeout_ms % 1000) * 1000000LL) % NSECS_PER_SEC;
+
+    pthread_mutex_lock(&pNtp->ready_lock);
+    while (!pNtp->ready && rc == 0)
+        rc = timeout_ms < 0 ? pthread_cond_wait(&pNtp->ready_cond, &pNtp->ready_lock) : pthread_cond_timedwait(&pNtp->ready_cond, &pNtp->ready_lock, &ts);
+    rc = pNtp->ready;
+    pthread_mutex_unlock(&pNtp->ready_lock);
+
+    if (!rc)
+        return -1;
+    return FLAG_GET(pNtp->synchronised) && !FLAG_GET(pNtp->error) ? 0 : 1;
+}
+
+int ntp_sync_h_ready_fd(tNtpSync *h) {
+    return FLAG_GET(h->ntp.inited) ? h->ntp.ready_fd : -1;
+}
+
+void ntp_sync_h_on_ready(tNtpSync *h, tCbOnReady cb, void *prm) {
+    h->cfg.cb_ready = cb;
+    h->cfg.cb_ready_prm = prm;
+}
+
+int ntp_sync_h_synchronised(tNtpSync *h) {
+    return FLAG_GET(h->ntp.synchronised);
+}
+
+double ntp_sync_h_get_time(tNtpSync *h) {
+    return (double)(_get_nanosec(h) - FLAG_GET(h->ntp.start_time_ns)) / 1000000;
+}
+
+int64_t ntp_sync_h_get_time_ns(tNtpSync *h) {
+    return _get_nanosec(h) - FLAG_GET(h->ntp.start_time_ns);
+}
+
+double ntp_sync_h_get_time_monotonic(tNtpSync *h) {
+    return (double)(_get_nanosec_monotonic(h) - FLAG_GET(h->ntp.start_time_ns)) / 1000000;
+}
+
+int64_t ntp_sync_h_get_time_monotonic_ns(tNtpSync *h) {
+    return _get_nanosec_monotonic(h) - FLAG_GET(h->ntp.start_time_ns);
+}
+
+uint64_t ntp_sync_h_monotonic_clamps(tNtpSync *h) {
+    return __atomic_load_n(&h->ntp.clamped, __ATOMIC_RELAXED);
+}
+
+uint64_t ntp_sync_h_get_ntp_time(tNtpSync *h) {
+    const tNtpSyncTimebase *tb = _get_timebase(h);
+
+    return (uint64_t)SLEWED_LOC_2_NTP(tb, TB_NSECS(tb));
+}
+
+double ntp_sync_h_start_time(tNtpSync *h) {
+    return (double)FLAG_GET(h->ntp.start_time_ns) / 1000000;
+}
+
+int64_t ntp_sync_h_start_time_ns(tNtpSync *h) {
+    return FLAG_GET(h->ntp.start_time_ns);
+}
+
+double ntp_sync_h_get_time_coarse(tNtpSync *h) {
+    return (double)ntp_sync_h_get_time_coarse_ns(h) / 1000000;
+}
+
+int64_t ntp_sync_h_get_time_coarse_ns(tNtpSync *h) {
+    return ntp_sync_page_tb_time_coarse_ns(_get_timebase(h)) - FLAG_GET(h->ntp.start_time_ns);
+}
+
+int64_t ntp_sync_h_coarse_resolution_ns(tNtpSync *h) {
+    tNtpSyncTimebase tb;
+
+    _read_timebase(h, &tb);
+    return tb.coarse_res;
+}
+
+int64_t ntp_sync_h_coarse_error_ns(tNtpSync *h) {
+    tNtpSyncTimebase tb;
+
+    _read_timebase(h, &tb);
+    return tb.coarse_err;
+}
+
+double ntp_sync_h_frequency_ppm(tNtpSync *h) {
+    tNtpSyncTimebase tb;
+
+    _read_timebase(h, &tb);
+    return (double)tb.freq / TWO_E32 * 1000000;
+}
+
+int ntp_sync_h_error(tNtpSync *h) {
+    return FLAG_GET(h->ntp.error);
+}
+
+void ntp_sync_h_on_error(tNtpSync *h, tCbOnErr cb, void *prm) {
+    h->ntp.cb_err = cb;
+    h->ntp.cb_err_prm = prm;
+}
+
+int ntp_sync_h_set_clock_source(tNtpSync *h, eNtpSyncClock src) {
+
+    if (src == eNtpSyncClock_tsc && !tsc_clock_supported()) {
+        DEBUG_LEVEL(DEBUG_BASIC, NTPSYNC_DBG("%s", "-- TSC clock source not supported\n"));
+        return 1;
+    }
+
+    h->cfg.clock_source = src;
+    return 0;
+}
+
+int ntp_sync_h_set_discipline(tNtpSync *h, eNtpSyncDiscipline d) {
+
+    if (d != eNtpSyncDiscipline_fll && d != eNtpSyncDiscipline_kalman)
+        return 1;
+
+    h->cfg.discipline = d;
+    return 0;
+}
+
+eNtpSyncClock ntp_sync_h_clock_source(tNtpSync *h) {
+    tNtpSyncTimebase tb;
+
+    _read_timebase(h, &tb);
+    return tb.use_tsc ? eNtpSyncClock_tsc : eNtpSyncClock_raw;
+}
+
+int ntp_sync_h_set_shared_page(tNtpSync *h, char *name) {
+
+    if (name != NULL && strlen(name) >= sizeof(h->cfg.page_name))
+        return 1;
+
+    strcpy(h->cfg.page_name, name != NULL ? name : "");
+    return 0;
+}
+
+int ntp_sync_h_set_burst_depth(tNtpSync *h, int depth) {
+
+    if (depth < 1 || depth > NTP_PKT_BUF_SZ)
+        return 1;
+
+    h->cfg.burst_depth = depth;
+    return 0;
+}
+
+int ntp_sync_h_set_tx_timestamps(tNtpSync *h, int on) {
+    h->cfg.tx_timestamps = on;
+    return 0;
+}
+
+int64_t ntp_sync_h_burst_duration_ns(tNtpSync *h) {
+    return FLAG_GET(h->ntp.burst_duration);
+}
+
+int ntp_sync_h_set_min_poll(tNtpSync *h, int ms) {
+
+    if (ms * 1000LL < INTER_SYNC_DELAY_MIN)
+        return 1;
+
+    h->cfg.min_poll = ms;
+    return 0;
+}
+
+int ntp_sync_h_poll_ms(tNtpSync *h) {
+    return FLAG_GET(h->ntp.poll_ms);
+}
+
+int ntp_sync_h_set_huffpuff(tNtpSync *h, int window_s) {
+
+    if (window_s < 0)
+        return 1;
+
+    h->cfg.huffpuff_window = window_s;
+    return 0;
+}
+
+int64_t ntp_sync_h_huffpuff_correction_ns(tNtpSync *h) {
+    return FLAG_GET(h->ntp.huffpuff_correction);
+}
+
+int64_t ntp_sync_h_huffpuff_min_delay_ns(tNtpSync *h) {
+    int64_t d = FLAG_GET(h->ntp.huffpuff_min_delay);
+
+    return d == INT64_MAX ? 0 : d;
+}
+
+int ntp_sync_h_set_iburst(tNtpSync *h, int on) {
+    h->cfg.iburst = on;
+    return 0;
+}
+
+int64_t ntp_sync_h_start_latency_ns(tNtpSync *h) {
+    return FLAG_GET(h->ntp.start_latency);
+}
+
+int ntp_sync_h_set_state_file(tNtpSync *h, char *path) {
+
+    if (path != NULL && strlen(path) + sizeof(".XXXXXX") > sizeof(h->cfg.state_file))
+        return 1;
+
+    strcpy(h->cfg.state_file, path != NULL ? path : "");
+    return 0;
+}
+
+int ntp_sync_h_warm_start(tNtpSync *h) {
+    return FLAG_GET(h->ntp.warm_start);
+}
+
+int ntp_sync_h_set_outlier_gate(tNtpSync *h, double k) {
+
+    if (k < 0)
+        return 1;
+
+    h->cfg.gate_k = k;
+    return 0;
+}
+
+uint64_t ntp_sync_h_outliers_offset(tNtpSync *h) {
+    return FLAG_GET(h->ntp.outliers_offset);
+}
+
+uint64_t ntp_sync_h_outliers_delay(tNtpSync *h) {
+    return FLAG_GET(h->ntp.outliers_delay);
+}
+
+const tNtpSyncPage *ntp_sync_h_page(tNtpSync *h) {
+    return FLAG_GET(h->ntp.inited) ? FLAG_GET(h->ntp.page) : NULL;
+}
+
+double ntp_sync_monotonic_time() {
+    return (double)GETNSECS() / 1000000;
+}
+
+//---- The default instance
+
+int ntp_sync_start(char *ip_address, double max_offset_ms, int inter_sync_delay_ms) {
+    return ntp_sync_h_start(&s_default, ip_address, max_offset_ms, inter_sync_delay_ms);
+}
+
+int ntp_sync_start_async(char *ip_address, double max_offset_ms, int inter_sync_delay_ms) {
+    return ntp_sync_h_start_async(&s_default, ip_address, max_offset_ms, inter_sync_delay_ms);
+}
+
+int ntp_sync_wait(int timeout_ms) {
+    return ntp_sync_h_wait(&s_default, timeout_ms);
+}
+
+int ntp_sync_ready_fd() {
+    return ntp_sync_h_ready_fd(&s_default);
+}
+
+void ntp_sync_on_ready(tCbOnReady cb, void *prm) {
+    ntp_sync_h_on_ready(&s_default, cb, prm);
+}
+
+void ntp_sync_stop() {
+    ntp_sync_h_stop(&s_default);
+}
+
+void ntp_sync_set_time(double ms) {
+    ntp_sync_h_set_time(&s_default, ms);
+}
+
+double ntp_sync_get_time() {
+    return (double)(_get_nanosec(&s_default) - FLAG_GET(s_default.ntp.start_time_ns)) / 1000000;
+}
+
+int64_t ntp_sync_get_time_ns() {
+    return _get_nanosec(&s_default) - FLAG_GET(s_default.ntp.start_time_ns);
+}
+
+double ntp_sync_get_time_monotonic() {
+    return (double)(_get_nanosec_monotonic(&s_default) - FLAG_GET(s_default.ntp.start_time_ns)) / 1000000;
+}
+
+int64_t ntp_sync_get_time_monotonic_ns() {
+    return _get_nanosec_monotonic(&s_default) - FLAG_GET(s_default.ntp.start_time_ns);
+}
+
+uint64_t ntp_sync_monotonic_clamps() {
+    return ntp_sync_h_monotonic_clamps(&s_default);
+}
+
+uint64_t ntp_sync_get_ntp_time() {
+    return ntp_sync_h_get_ntp_time(&s_default);
+}
+
+double ntp_sync_start_time() {
+    return (double)FLAG_GET(s_default.ntp.start_time_ns) / 1000000;
+}
+
+int64_t ntp_sync_start_time_ns() {
+    return FLAG_GET(s_default.ntp.start_time_ns);
+}
+
+double ntp_sync_get_time_coarse() {
+    return ntp_sync_h_get_time_coarse(&s_default);
+}
+
+int64_t ntp_sync_get_time_coarse_ns() {
+    return ntp_sync_h_get_time_coarse_ns(&s_default);
+}
+
+int64_t ntp_sync_coarse_resolution_ns() {
+    return ntp_sync_h_coarse_resolution_ns(&s_default);
+}
+
+int64_t ntp_sync_coarse_error_ns() {
+    return ntp_sync_h_coarse_error_ns(&s_default);
+}
+
+double ntp_sync_frequency_ppm() {
+    return ntp_sync_h_frequency_ppm(&s_default);
+}
+
+int ntp_sync_synchronised() {
+    return ntp_sync_h_synchronised(&s_default);
+}
+
+int ntp_sync_error() {
+    return ntp_sync_h_error(&s_default);
+}
+
+void ntp_sync_on_error(tCbOnErr cb, void *prm) {
+    ntp_sync_h_on_error(&s_default, cb, prm);
+}
+
+int ntp_sync_set_clock_source(eNtpSyncClock src) {
+    return ntp_sync_h_set_clock_source(&s_default, src);
+}
+
+int ntp_sync_set_discipline(eNtpSyncDiscipline d) {
+    return ntp_sync_h_set_discipline(&s_default, d);
+}
+
+eNtpSyncClock ntp_sync_clock_source() {
+    return ntp_sync_h_clock_source(&s_default);
+}
+
+int ntp_sync_set_shared_page(char *name) {
+    return ntp_sync_h_set_shared_page(&s_default, name);
+}
+
+int ntp_sync_set_burst_depth(int depth) {
+    return ntp_sync_h_set_burst_depth(&s_default, depth);
+}
+
+int ntp_sync_set_tx_timestamps(int on) {
+    return ntp_sync_h_set_tx_timestamps(&s_default, on);
+}
+
+int64_t ntp_sync_burst_duration_ns() {
+    return ntp_sync_h_burst_duration_ns(&s_default);
+}
+
+int ntp_sync_set_min_poll(int ms) {
+    return ntp_sync_h_set_min_poll(&s_default, ms);
+}
+
+int ntp_sync_poll_ms() {
+    return ntp_sync_h_poll_ms(&s_default);
+}
+
+int ntp_sync_set_huffpuff(int window_s) {
+    return ntp_sync_h_set_huffpuff(&s_default, window_s);
+}
+
+int64_t ntp_sync_huffpuff_correction_ns() {
+    return ntp_sync_h_huffpuff_correction_ns(&s_default);
+}
+
+int64_t ntp_sync_huffpuff_min_delay_ns() {
+    return ntp_sync_h_huffpuff_min_delay_ns(&s_default);
+}
+
+int ntp_sync_set_iburst(int on) {
+    return ntp_sync_h_set_iburst(&s_default, on);
+}
+
+int64_t ntp_sync_start_latency_ns() {
+    return ntp_sync_h_start_latency_ns(&s_default);
+}
+
+int ntp_sync_set_state_file(char *path) {
+    return ntp_sync_h_set_state_file(&s_default, path);
+}
+
+int ntp_sync_warm_start() {
+    return ntp_sync_h_warm_start(&s_default);
+}
+
+int ntp_sync_set_outlier_gate(double k) {
+    return ntp_sync_h_set_outlier_gate(&s_default, k);
+}
+
+uint64_t ntp_sync_outliers_offset() {
+    return ntp_sync_h_outliers_offset(&s_default);
+}
+
+uint64_t ntp_sync_outliers_delay() {
+    return ntp_sync_h_outliers_delay(&s_default);
+}
+
+const tNtpSyncPage *ntp_sync_page() {
+    return ntp_sync_h_page(&s_default);
 }
@@ -8,6 +8,12 @@
 #ifndef __NTPSYNC_H__
 #define __NTPSYNC_H__
 
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 typedef enum {
     eNtpSyncError_no,       // don't move this
     eNtpSyncError_send,
@@ -15,18 +21,210 @@ typedef enum {
     eNtpSyncError_version,
     eNtpSyncError_kod,      // kiss of death
     eNtpSyncError_unexpected,
-    eNtpSyncError_accuracy_broken
+    eNtpSyncError_accuracy_broken,
+    eNtpSyncError_unsynchronised, // the servers replied, but none of them is synchronised
+    eNtpSyncError_select    // the servers kept disagreeing on the time
 } eNtpSyncError;
 
+typedef enum {
+    eNtpSyncClock_raw,      // CLOCK_MONOTONIC_RAW (default)
+    eNtpSyncClock_tsc       // time stamp counter calibrated against the raw clock
+} eNtpSyncClock;
+
+typedef enum {
+    eNtpSyncDiscipline_fll,     // offset of the best samples, frequency locked loop (default)
+    eNtpSyncDiscipline_kalman   // offset and skew estimated by a Kalman filter on every sample
+} eNtpSyncDiscipline;
+
 typedef void (*tCbOnErr)(eNtpSyncError err, void *prm);
+typedef void (*tCbOnReady)(eNtpSyncError err, void *prm);  // err is eNtpSyncError_no when synchronised
 
+// ip_address: host name or address of the server, optionally followed by :port (123 by default), or a comma
+// separated list of up to 8 of them: the truechimers among the servers are selected and their offsets combined
+// (rfc5905). A server failing is left out, the synchronisation fails only when none of them replies.
 int ntp_sync_start(char *ip_address, double max_offset_ms, int inter_sync_delay_ms);
+
+// Same as ntp_sync_start, without waiting for the synchronisation: returns 0 once the servers are set up.
+// The outcome (the first synchronisation, or the error that prevents it) is told as soon as it's known,
+// in any of these ways:
+//  - ntp_sync_wait: 0 if synchronised, 1 on error (or when stopped), -1 if not known within timeout_ms
+//    (< 0 to wait for as long as needed)
+//  - ntp_sync_ready_fd: an eventfd (Linux only, else -1), readable from then on (it is never read by
+//    the library), to be polled from the start to the stop
+//  - the callback of ntp_sync_on_ready (to be set before the start), called by the sync thread
+// The origin of the times is the first synchronisation, unless ntp_sync_set_time is called before.
+int ntp_sync_start_async(char *ip_address, double max_offset_ms, int inter_sync_delay_ms);
+int ntp_sync_wait(int timeout_ms);
+int ntp_sync_ready_fd();
+void ntp_sync_on_ready(tCbOnReady cb, void *prm);
+
 void ntp_sync_stop();
 void ntp_sync_set_time(double ms);
 double ntp_sync_get_time();
+int64_t ntp_sync_get_time_ns();         // same as ntp_sync_get_time() but in ns
+uint64_t ntp_sync_get_ntp_time();       // absolute time in NTP 32.32 fixed point format
+
+// Same as ntp_sync_get_time, but never goes backwards, not even across threads: a read that would
+// (first adjustement, a new slew...) returns the latest time returned instead, and is counted
+// by ntp_sync_monotonic_clamps. ntp_sync_set_time moves the origin of the returned times.
+double ntp_sync_get_time_monotonic();
+int64_t ntp_sync_get_time_monotonic_ns();
+uint64_t ntp_sync_monotonic_clamps();
+
 double ntp_sync_start_time();
+int64_t ntp_sync_start_time_ns();       // unix time in ns
+
+// Cheaper flavour of ntp_sync_get_time, based on the coarse (tick based) monotonic clock:
+// its resolution and the error bound of the returned time are reported by the last two
+double ntp_sync_get_time_coarse();
+int64_t ntp_sync_get_time_coarse_ns();
+int64_t ntp_sync_coarse_resolution_ns();
+int64_t ntp_sync_coarse_error_ns();
+
+// Frequency correction applied to the local clock [ppm]: the estimated drift of its oscillator
+double ntp_sync_frequency_ppm();
+int ntp_sync_synchronised();           // 1 once the time is within max_offset_ms
 int ntp_sync_error();
 void ntp_sync_on_error(tCbOnErr cb, void *prm);
 double ntp_sync_monotonic_time();
 
+// To be called before ntp_sync_start: returns 0 if the source is supported.
+// The tsc is dropped in favour of the raw clock as soon as it proves not reliable.
+int ntp_sync_set_clock_source(eNtpSyncClock src);
+eNtpSyncClock ntp_sync_clock_source();
+
+// To be called before ntp_sync_start: how the offset and the frequency of the clock are estimated.
+// With the Kalman filter every sample accepted (of the servers surviving the selection) refines them,
+// weighed by its delay and dispersion. Returns 0 on success.
+int ntp_sync_set_discipline(eNtpSyncDiscipline d);
+
+// To be called before ntp_sync_start: publish the timebase in the shared memory object name
+// (ie. "/ntpsync"), so that other processes can read the time with NtpSyncPage.h only. A page has a
+// single writer: the start fails while another synchronisation (of any process) publishes in it.
+// NULL or "" to keep it private. Returns 0 on success.
+int ntp_sync_set_shared_page(char *name);
+
+// To be called before ntp_sync_start: how many requests (1..8) a burst keeps in flight, 1 being
+// a strict send/receive sequence. Returns 0 on success. The default, 8, takes about 1 round trip.
+int ntp_sync_set_burst_depth(int depth);
+int64_t ntp_sync_burst_duration_ns();   // how long the last burst of requests took
+
+// To be called before ntp_sync_start: when on, the departure time of the requests is taken from
+// the kernel transmit timestamps (SO_TIMESTAMPING), where available. Returns 0 on success.
+int ntp_sync_set_tx_timestamps(int on);
+
+// To be called before ntp_sync_start: the shortest interval in between one synch and the following
+// (at least 1000 ms, the default), the longest being inter_sync_delay_ms. The interval in use grows
+// while the measured offsets stay within their jitter and the frequency is steady, and drops back
+// as soon as they don't. Returns 0 on success.
+int ntp_sync_set_min_poll(int ms);
+int ntp_sync_poll_ms();                 // interval in between the current synch and the next one
+
+// To be called before ntp_sync_start: the first burst is followed within a few ms by another one which
+// confirms the step it made, and so on (4 bursts at most) until one does: the synchronisation takes a few
+// round trips instead of min_poll, and is never declared on the first burst alone. Off by default.
+// Returns 0 on success.
+int ntp_sync_set_iburst(int on);
+int64_t ntp_sync_start_latency_ns();    // from the start to the first synchronisation, 0 until then
+
+// To be called before ntp_sync_start: keep what the synchronisation learned (the frequency of the local
+// clock, the time it kept, the delay and jitter of the servers) in the file at path, saved every minute or
+// so while synchronised and at the stop (at the stop only on a loop, where the disk must not hold the others). A restart within the same boot resumes from there: disciplined at
+// once, with the interval of the updates it had reached, and synchronised on the first burst that agrees.
+// A state from before a reboot or a suspension is ignored in part or entirely. One file per instance;
+// NULL (the default) is off. Returns 0 on success.
+int ntp_sync_set_state_file(char *path);
+int ntp_sync_warm_start();              // what the start took from the state: 0 nothing, 1 the frequency, 2 the time too
+
+// To be called before ntp_sync_start: correct the offsets of the samples delayed by congestion
+// (huff-n'-puff filter), against the minimum delay of each server over the last window_s seconds.
+// For asymmetric links (ie. ADSL): hours are typical, 0 (the default) is off. Returns 0 on success.
+int ntp_sync_set_huffpuff(int window_s);
+int64_t ntp_sync_huffpuff_correction_ns();  // applied to the system peer offset at the last synch
+int64_t ntp_sync_huffpuff_min_delay_ns();   // minimum delay of the system peer within the window
+
+// To be called before ntp_sync_start: a sample whose offset is more than k MADs (median absolute
+// deviations) from the median of the last 32 samples of its server, or whose delay is more than k MADs
+// above their median, is rejected before it can reach the clock. 5 by default, 0 is off.
+// Returns 0 on success. The rejected samples are counted by the two following.
+int ntp_sync_set_outlier_gate(double k);
+uint64_t ntp_sync_outliers_offset();
+uint64_t ntp_sync_outliers_delay();
+
+
+// -- Several synchronisations in the same process (ie. one per time domain): an instance has its own servers,
+// thread, timebase and settings, the functions above working on the default one. Each of them has its
+// ntp_sync_h_ version, same behaviour, on the instance given, whose readers cost as the ones above: up to
+// 7 instances alive at once. The readers of the ones created beyond share a single copy of the timebase
+// per thread, which each read of another of them replaces: they cost a full read of the page then.
+typedef struct tNtpSync tNtpSync;
+
+tNtpSync *ntp_sync_create();            // NULL if out of memory
+void ntp_sync_destroy(tNtpSync *h);     // stops it, if started. Not for the default instance
+tNtpSync *ntp_sync_default();           // the instance of the functions above
+
+int ntp_sync_h_start(tNtpSync *h, char *ip_address, double max_offset_ms, int inter_sync_delay_ms);
+int ntp_sync_h_start_async(tNtpSync *h, char *ip_address, double max_offset_ms, int inter_sync_delay_ms);
+int ntp_sync_h_wait(tNtpSync *h, int timeout_ms);
+int ntp_sync_h_ready_fd(tNtpSync *h);
+void ntp_sync_h_on_ready(tNtpSync *h, tCbOnReady cb, void *prm);
+void ntp_sync_h_stop(tNtpSync *h);
+void ntp_sync_h_set_time(tNtpSync *h, double ms);
+double ntp_sync_h_get_time(tNtpSync *h);
+int64_t ntp_sync_h_get_time_ns(tNtpSync *h);
+uint64_t ntp_sync_h_get_ntp_time(tNtpSync *h);
+double ntp_sync_h_get_time_monotonic(tNtpSync *h);
+int64_t ntp_sync_h_get_time_monotonic_ns(tNtpSync *h);
+uint64_t ntp_sync_h_monotonic_clamps(tNtpSync *h);
+double ntp_sync_h_start_time(tNtpSync *h);
+int64_t ntp_sync_h_start_time_ns(tNtpSync *h);
+double ntp_sync_h_get_time_coarse(tNtpSync *h);
+int64_t ntp_sync_h_get_time_coarse_ns(tNtpSync *h);
+int64_t ntp_sync_h_coarse_resolution_ns(tNtpSync *h);
+int64_t ntp_sync_h_coarse_error_ns(tNtpSync *h);
+double ntp_sync_h_frequency_ppm(tNtpSync *h);
+int ntp_sync_h_error(tNtpSync *h);
+void ntp_sync_h_on_error(tNtpSync *h, tCbOnErr cb, void *prm);
+int ntp_sync_h_set_clock_source(tNtpSync *h, eNtpSyncClock src);
+eNtpSyncClock ntp_sync_h_clock_source(tNtpSync *h);
+int ntp_sync_h_set_discipline(tNtpSync *h, eNtpSyncDiscipline d);
+int ntp_sync_h_set_shared_page(tNtpSync *h, char *name);  // a name per instance
+int ntp_sync_h_set_burst_depth(tNtpSync *h, int depth);
+int64_t ntp_sync_h_burst_duration_ns(tNtpSync *h);
+int ntp_sync_h_set_tx_timestamps(tNtpSync *h, int on);
+int ntp_sync_h_set_min_poll(tNtpSync *h, int ms);
+int ntp_sync_h_poll_ms(tNtpSync *h);
+int ntp_sync_h_set_huffpuff(tNtpSync *h, int window_s);
+int64_t ntp_sync_h_huffpuff_correction_ns(tNtpSync *h);
+int64_t ntp_sync_h_huffpuff_min_delay_ns(tNtpSync *h);
+int ntp_sync_h_set_iburst(tNtpSync *h, int on);
+int64_t ntp_sync_h_start_latency_ns(tNtpSync *h);
+int ntp_sync_h_set_state_file(tNtpSync *h, char *path);
+int ntp_sync_h_warm_start(tNtpSync *h);
+int ntp_sync_h_set_outlier_gate(tNtpSync *h, double k);
+uint64_t ntp_sync_h_outliers_offset(tNtpSync *h);
+uint64_t ntp_sync_h_outliers_delay(tNtpSync *h);
+int ntp_sync_h_synchronised(tNtpSync *h);
+
+// -- Event loop: a single thread synchronises any number of instances, with no thread per instance nor per
+// server. The sockets and the timers of the instances started on a loop are multiplexed on its fd (epoll,
+// Linux only): either the loop runs a thread of its own (ntp_sync_loop_start), or the application waits
+// for the fd to be readable in its own reactor, and calls ntp_sync_process then.
+typedef struct tNtpSyncLoop tNtpSyncLoop;
+
+tNtpSyncLoop *ntp_sync_loop_create();           // NULL on error
+void ntp_sync_loop_destroy(tNtpSyncLoop *l);    // the instances started on it must be stopped first
+int ntp_sync_loop_start(tNtpSyncLoop *l);       // 0 on success
+int ntp_sync_loop_fd(tNtpSyncLoop *l);
+int ntp_sync_process(tNtpSyncLoop *l);          // never blocks: the events handled, -1 on error
+
+// As ntp_sync_h_start_async, on the loop: the callbacks of ntp_sync_h_on_ready and ntp_sync_h_on_error are
+// called by the thread running the loop, or within ntp_sync_process, once it released the loop: they may
+// stop or destroy their instance, or any other of the loop.
+int ntp_sync_h_start_on(tNtpSync *h, tNtpSyncLoop *l, char *ip_address, double max_offset_ms, int inter_sync_delay_ms);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif
@@ -0,0 +1,220 @@
+//
+//  NtpSyncBench.c
+//
+//  Author: Filippin luca
+//  luca.filippin@gmail.com
+//
+//  Read path scalability: N threads read the synchronised time as fast as they can, first
+//  through the library (thread local timebase cache), then straight from the timebase page
+//  (the whole timebase is copied out of the shared page at each read), then through the
+//  inline readers of NtpSyncFast.h and through the monotonic flavour (all the threads share
+//  its floor).
+//  With -w each run is repeated while another thread keeps writing the library control
+//  state (as the sync thread does): given a spare core for it, the per thread read cost
+//  must not change, since the read path shares no cache line with it. -p pins the writer
+//  to the first cpu and the readers to the others (Linux), so that they never time-share
+//  a core: a cost that holds is then the sign of no coherence misses, which
+//      perf c2c record ./NtpSyncBench -p -w -t 4 && perf c2c report
+//  confirms (no HITM on the lines of the library state). With a single cpu the -w runs
+//  tell nothing.
+//
+//  To build on Linux:
+//  gcc -O2 NtpSyncBench.c NtpSync.c NtpFilter.c NtpSelect.c NtpKalman.c NtpState.c UdpConn.c TscClock.c DebugUtil.c -lpthread -lrt -lm -o NtpSyncBench
+//
+//  Usage: NtpSyncBench [-a server] [-t max threads] [-d ms per run] [-w] [-p]
+//
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "NtpSync.h"
+#include "NtpSyncPage.h"
+#include "NtpSyncFast.h"
+
+#define BENCH_PAGE      "/ntpsync-bench"
+#define BENCH_BATCH     1000
+
+typedef enum {
+    eBenchMode_cached,
+    eBenchMode_page,
+    eBenchMode_fast,
+    eBenchMode_monotonic
+} eBenchMode;
+
+typedef struct {
+    pthread_t thread;
+    eBenchMode mode;
+    const tNtpSyncPage *page;
+    volatile int *stop;
+    int cpu;                // pinned to, -1 if not
+    uint64_t reads;
+    int64_t backwards;
+} tBenchReader;
+
+static const char *s_mode_name[] = { "cached", "page", "fast", "mono" };
+
+static int s_cpus = 1;      // online
+static int s_pin = 0;
+
+static void _on_error(eNtpSyncError err, void *prm) {
+    (void)err;
+    (void)prm;
+}
+
+static void _pin(int cpu) {
+#ifdef __linux__
+    cpu_set_t set;
+
+    if (cpu < 0)
+        return;
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+        fprintf(stderr, "Cannot pin to cpu %d\n", cpu);
+#else
+    (void)cpu;
+#endif
+}
+
+// Keep dirtying the control region of the library state
+static void *_writer(void *prm) {
+    volatile int *stop = (volatile int *)prm;
+    int n = 0;
+
+    if (s_pin)
+        _pin(0);
+
+    while (!*stop) {
+        ntp_sync_on_error(_on_error, &n);
+        n += ntp_sync_error();
+    }
+    return NULL;
+}
+
+static void *_reader(void *prm) {
+    tBenchReader *r = (tBenchReader *)prm;
+    tNtpSyncFast fast;
+    int64_t t, prev = 0;
+    int i;
+
+    _pin(r->cpu);
+    ntp_sync_fast_init(&fast);
+
+    while (!*r->stop) {
+        for (i = 0; i < BENCH_BATCH; i++) {
+            switch (r->mode) {
+                case eBenchMode_cached: t = ntp_sync_get_time_ns(); break;
+                case eBenchMode_page: t = ntp_sync_page_time_ns(r->page); break;
+                case eBenchMode_fast: t = ntp_sync_fast_time_ns(&fast); break;
+                default: t = ntp_sync_get_time_monotonic_ns(); break;
+            }
+            r->backwards += t < prev;
+            prev = t;
+        }
+        r->reads += BENCH_BATCH;
+    }
+    return NULL;
+}
+
+static void _run(eBenchMode mode, const tNtpSyncPage *page, int n_threads, int duration_ms, int contention) {
+    tBenchReader *r = calloc(n_threads, sizeof(tBenchReader));
+    pthread_t writer;
+    volatile int stop = 0;
+    uint64_t reads = 0;
+    int64_t backwards = 0;
+    double start, elapsed;
+    int i;
+
+    start = ntp_sync_monotonic_time();
+
+    if (contention)
+        pthread_create(&writer, NULL, _writer, (void *)&stop);
+
+    for (i = 0; i < n_threads; i++) {
+        r[i].mode = mode;
+        r[i].page = page;
+        r[i].stop = &stop;
+        r[i].cpu = s_pin && s_cpus > 1 ? 1 + i % (s_cpus - 1) : -1; // the first cpu is the writer's
+        pthread_create(&r[i].thread, NULL, _reader, &r[i]);
+    }
+
+    usleep(duration_ms * 1000);
+    stop = 1;
+
+    for (i = 0; i < n_threads; i++) {
+        pthread_join(r[i].thread, NULL);
+        reads += r[i].reads;
+        backwards += r[i].backwards;
+    }
+    elapsed = ntp_sync_monotonic_time() - start;
+
+    if (contention)
+        pthread_join(writer, NULL);
+
+    printf("%-8s%s threads: %3d  reads: %12llu  %8.2f Mreads/s  %8.2f ns/read/thread  backwards: %lld\n",
+           s_mode_name[mode], contention ? "+w" : "  ", n_threads, (unsigned long long)reads, reads / elapsed / 1000,
+           elapsed * 1000000 * n_threads / reads, (long long)backwards);
+    free(r);
+}
+
+int main(int argc, char **argv) {
+    char *server = "127.0.0.1";
+    int max_threads = 64, duration_ms = 1000, contention = 0;
+    tNtpSyncPage *page;
+    int opt, n;
+
+    while ((opt = getopt(argc, argv, "a:t:d:wp")) != -1) {
+        switch (opt) {
+            case 'a': server = optarg; break;
+            case 't': max_threads = atoi(optarg); break;
+            case 'd': duration_ms = atoi(optarg); break;
+            case 'w': contention = 1; break;
+            case 'p': s_pin = 1; break;
+            default:
+                fprintf(stderr, "Usage: %s [-a server] [-t max threads] [-d ms per run] [-w] [-p]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    s_cpus = (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (contention && s_cpus < 2)
+        fprintf(stderr, "%s\n", "A single cpu: the writer time-shares with the readers, the -w runs tell nothing");
+    else if (s_pin)
+        printf("writer on cpu 0, readers on cpus 1-%d\n", s_cpus - 1);
+
+    ntp_sync_set_shared_page(BENCH_PAGE);
+
+    if (ntp_sync_start(server, 0.5, 5000) != 0) {
+        fprintf(stderr, "Synchronisation with %s failed (%d)\n", server, ntp_sync_error());
+        ntp_sync_stop();
+        return 1;
+    }
+
+    if ((page = ntp_sync_page_open(BENCH_PAGE)) == NULL) {
+        fprintf(stderr, "%s\n", "Cannot map the timebase page");
+        ntp_sync_stop();
+        return 1;
+    }
+
+    for (n = 1; n <= max_threads; n *= 2) {
+        _run(eBenchMode_cached, page, n, duration_ms, 0);
+        _run(eBenchMode_page, page, n, duration_ms, 0);
+        _run(eBenchMode_fast, page, n, duration_ms, 0);
+        _run(eBenchMode_monotonic, page, n, duration_ms, 0);
+
+        if (contention) {
+            _run(eBenchMode_cached, page, n, duration_ms, 1);
+            _run(eBenchMode_page, page, n, duration_ms, 1);
+        }
+    }
+
+    printf("monotonic clamps: %llu\n", (unsigned long long)ntp_sync_monotonic_clamps());
+    ntp_sync_page_close(page);
+    ntp_sync_stop();
+    return 0;
+}
@@ -0,0 +1,206 @@
+//
+//  NtpSyncBurstBench.c
+//
+//  Author: Filippin luca
+//  luca.filippin@gmail.com
+//
+//  Burst duration: a stand-in NTP server on 127.0.0.1 answers each request after a simulated
+//  network round trip, without serialising them. The library collects its bursts first with
+//  a strict send/receive sequence (1 request in flight), then with more requests in flight.
+//
+//  To build on Linux:
+//  gcc -O2 NtpSyncBurstBench.c NtpSync.c NtpFilter.c NtpSelect.c NtpKalman.c NtpState.c UdpConn.c TscClock.c DebugUtil.c -lpthread -lrt -lm -o NtpSyncBurstBench
+//
+//  Usage: NtpSyncBurstBench [-r rtt ms] [-p port] [-n bursts] 2>/dev/null
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include "NtpSync.h"
+
+#define BENCH_QUEUE         64
+#define BENCH_JAN_1970      2208988800ULL
+#define BENCH_MAX_DEPTH     8
+
+typedef struct {
+    unsigned char pkt[48];
+    struct sockaddr_in from;
+    int64_t due;            // [ns]
+} tBenchReply;
+
+typedef struct {
+    pthread_t thread;
+    int s;
+    int64_t rtt;            // [ns]
+    volatile int stop;
+    tBenchReply queue[BENCH_QUEUE];
+    int head, count;
+} tBenchServer;
+
+static int64_t _now(clockid_t clk) {
+    struct timespec tp;
+
+    clock_gettime(clk, &tp);
+    return (int64_t)tp.tv_sec * 1000000000LL + tp.tv_nsec;
+}
+
+static void _put_ntp(unsigned char *p, int64_t unix_ns) {
+    uint64_t ts = ((uint64_t)(unix_ns / 1000000000LL) + BENCH_JAN_1970) << 32 | ((uint64_t)(unix_ns % 1000000000LL) << 32) / 1000000000LL;
+    uint32_t h = htonl((uint32_t)(ts >> 32)), l = htonl((uint32_t)ts);
+
+    memcpy(p, &h, 4);
+    memcpy(p + 4, &l, 4);
+}
+
+// Stamp the receive time at once, send the reply when its round trip has elapsed
+static void *_server(void *prm) {
+    tBenchServer *srv = (tBenchServer *)prm;
+    tBenchReply *r;
+    unsigned char req[48];
+    socklen_t len;
+    struct timeval tv;
+    fd_set fds;
+    int64_t wait;
+
+    while (!srv->stop) {
+        wait = 10000000;
+
+        if (srv->count > 0) {
+            r = &srv->queue[srv->head];
+            wait = r->due - _now(CLOCK_MONOTONIC);
+
+            if (wait <= 0) {
+                _put_ntp(r->pkt + 40, _now(CLOCK_REALTIME));
+                sendto(srv->s, r->pkt, sizeof(r->pkt), 0, (struct sockaddr *)&r->from, sizeof(r->from));
+                srv->head = (srv->head + 1) % BENCH_QUEUE;
+                srv->count--;
+                continue;
+            }
+        }
+
+        tv.tv_sec = 0;
+        tv.tv_usec = wait / 1000;
+        FD_ZERO(&fds);
+        FD_SET(srv->s, &fds);
+
+        if (select(srv->s + 1, &fds, NULL, NULL, &tv) <= 0 || srv->count == BENCH_QUEUE)
+            continue;
+
+        r = &srv->queue[(srv->head + srv->count) % BENCH_QUEUE];
+        len = sizeof(r->from);
+
+        if (recvfrom(srv->s, req, sizeof(req), 0, (struct sockaddr *)&r->from, &len) != sizeof(req))
+            continue;
+
+        memset(r->pkt, 0, sizeof(r->pkt));
+        _put_ntp(r->pkt + 32, _now(CLOCK_REALTIME));            // receive
+        r->pkt[0] = (0 << 6) | (4 << 3) | 4;                    // LI 0, version 4, server
+        r->pkt[1] = 2;                                          // stratum
+        r->pkt[2] = 6;                                          // poll
+        r->pkt[3] = (unsigned char)-20;                         // precision
+        memcpy(r->pkt + 12, "LOCL", 4);                         // refid
+        _put_ntp(r->pkt + 16, _now(CLOCK_REALTIME) - 10000000000LL); // reference
+        memcpy(r->pkt + 24, req + 40, 8);                       // origin = request transmit
+        r->due = _now(CLOCK_MONOTONIC) + srv->rtt;
+        srv->count++;
+    }
+    return NULL;
+}
+
+static int _server_start(tBenchServer *srv, int port, int64_t rtt) {
+    struct sockaddr_in addr;
+
+    memset(srv, 0, sizeof(tBenchServer));
+    srv->rtt = rtt;
+
+    if ((srv->s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) < 0)
+        return 1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (bind(srv->s, (struct sockaddr *)&addr, sizeof(addr)) != 0 || pthread_create(&srv->thread, NULL, _server, srv) != 0) {
+        close(srv->s);
+        return 1;
+    }
+    return 0;
+}
+
+static void _server_stop(tBenchServer *srv) {
+    srv->stop = 1;
+    pthread_join(srv->thread, NULL);
+    close(srv->s);
+}
+
+// Collect the duration of n bursts: the first one is over when ntp_sync_start returns
+static int _run(char *server, int depth, int n) {
+    int64_t d, last = 0, sum = 0, dmin = INT64_MAX, dmax = 0;
+    int i = 0, polls = 0;
+
+    ntp_sync_set_burst_depth(depth);
+
+    if (ntp_sync_start(server, 5, 1100) != 0) {
+        fprintf(stderr, "Synchronisation with %s failed (%d)\n", server, ntp_sync_error());
+        ntp_sync_stop();
+        return 1;
+    }
+
+    while (i < n && polls++ < n * 300) {
+        if ((d = ntp_sync_burst_duration_ns()) != last) {
+            last = d;
+            sum += d;
+            dmin = d < dmin ? d : dmin;
+            dmax = d > dmax ? d : dmax;
+            i++;
+        }
+        usleep(10000);
+    }
+    ntp_sync_stop();
+
+    if (i > 0)
+        printf("in flight: %d  bursts: %3d  burst duration (min/avg/max): %8.3f / %8.3f / %8.3f ms\n",
+               depth, i, dmin / 1e6, sum / i / 1e6, dmax / 1e6);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    int port = 12300, n = 5, opt;
+    double rtt_ms = 40;
+    tBenchServer srv;
+    char server[64];
+
+    while ((opt = getopt(argc, argv, "r:p:n:")) != -1) {
+        switch (opt) {
+            case 'r': rtt_ms = atof(optarg); break;
+            case 'p': port = atoi(optarg); break;
+            case 'n': n = atoi(optarg); break;
+            default:
+                fprintf(stderr, "Usage: %s [-r rtt ms] [-p port] [-n bursts]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    if (_server_start(&srv, port, (int64_t)(rtt_ms * 1000000)) != 0) {
+        fprintf(stderr, "Cannot start the stand-in server on port %d\n", port);
+        return 1;
+    }
+
+    snprintf(server, sizeof(server), "127.0.0.1:%d", port);
+    printf("stand-in server round trip: %.3f ms\n", rtt_ms);
+
+    _run(server, 1, n);
+    _run(server, BENCH_MAX_DEPTH, n);
+
+    _server_stop(&srv);
+    return 0;
+}
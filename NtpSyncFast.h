@@ -0,0 +1,85 @@
+//
+//  NtpSyncFast.h
+//
+//  Author: Filippin luca
+//  luca.filippin@gmail.com
+//
+//  Inline readers of the synchronised time: the whole conversion is compiled into the caller,
+//  with no call into the library. They work on the timebase page the library publishes and
+//  keep their copy of it in a tNtpSyncFast, to be owned by a single thread (ie. declared
+//  __thread or on the stack of a hot loop):
+//
+//      tNtpSyncFast f;
+//      if (ntp_sync_fast_init(&f) == 0)
+//          for (...)
+//              ms = ntp_sync_fast_time(&f);
+//
+//  ntp_sync_fast_init must follow ntp_sync_start and ntp_sync_set_time, and the readers
+//  must not be used after ntp_sync_stop. ntp_sync_fast_init_h is the same for an instance
+//  of ntp_sync_create.
+//
+
+#ifndef __NTPSYNCFAST_H__
+#define __NTPSYNCFAST_H__
+
+#include <string.h>
+#include "NtpSyncPage.h"
+#include "NtpSync.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    const tNtpSyncPage *page;
+    int64_t start_time_ns;      // origin of the returned times [unix ns]
+    tNtpSyncTbCache cache;
+} tNtpSyncFast;
+
+// The page the library publishes the timebase in (shared or not)
+const tNtpSyncPage *ntp_sync_page();
+const tNtpSyncPage *ntp_sync_h_page(tNtpSync *h);
+
+// Returns 0 on success, 1 if the instance is not started or publishes a page of another layout
+NTPSYNC_INLINE int ntp_sync_fast_init_h(tNtpSyncFast *f, tNtpSync *h) {
+    const tNtpSyncPage *p = ntp_sync_h_page(h);
+
+    memset(f, 0, sizeof(tNtpSyncFast)); // the first read fills the cache
+
+    if (p == NULL || p->magic != NTPSYNC_PAGE_MAGIC || p->version != NTPSYNC_PAGE_VERSION || p->size < sizeof(tNtpSyncPage))
+        return 1;
+
+    f->page = p;
+    f->start_time_ns = ntp_sync_h_start_time_ns(h);
+    return 0;
+}
+
+NTPSYNC_INLINE int ntp_sync_fast_init(tNtpSyncFast *f) {
+    return ntp_sync_fast_init_h(f, ntp_sync_default());
+}
+
+// Same as ntp_sync_get_time_ns
+NTPSYNC_INLINE int64_t ntp_sync_fast_time_ns(tNtpSyncFast *f) {
+    return ntp_sync_page_tb_time_ns(ntp_sync_page_cached(f->page, &f->cache)) - f->start_time_ns;
+}
+
+// Same as ntp_sync_get_time
+NTPSYNC_INLINE double ntp_sync_fast_time(tNtpSyncFast *f) {
+    return (double)ntp_sync_fast_time_ns(f) / 1000000;
+}
+
+// Same as ntp_sync_get_time_coarse_ns
+NTPSYNC_INLINE int64_t ntp_sync_fast_time_coarse_ns(tNtpSyncFast *f) {
+    return ntp_sync_page_tb_time_coarse_ns(ntp_sync_page_cached(f->page, &f->cache)) - f->start_time_ns;
+}
+
+// Same as ntp_sync_get_time_coarse
+NTPSYNC_INLINE double ntp_sync_fast_time_coarse(tNtpSyncFast *f) {
+    return (double)ntp_sync_fast_time_coarse_ns(f) / 1000000;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,247 @@
+//
+//  NtpSyncPage.h
+//
+//  Author: Filippin luca
+//  luca.filippin@gmail.com
+//
+//  The timebase page: the parameters the sync thread publishes to convert the local
+//  monotonic clock into the synchronised time. The page lives in the process memory
+//  or, when shared (see ntp_sync_set_shared_page), in a POSIX shared memory object,
+//  so that any process can read the synchronised time with this header only:
+//
+//      tNtpSyncPage *p = ntp_sync_page_open("/ntpsync");
+//      if (p != NULL && ntp_sync_page_synchronised(p))
+//          unix_ns = ntp_sync_page_time_ns(p);
+//
+
+#ifndef __NTPSYNCPAGE_H__
+#define __NTPSYNCPAGE_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "TscClock.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if !defined(NTPSYNC_INLINE)
+    #if defined(__GNUC__)
+        #define NTPSYNC_INLINE static __inline__ __attribute__((always_inline))
+    #else
+        #define NTPSYNC_INLINE static __inline
+    #endif
+#endif
+
+#define NTPSYNC_PAGE_MAGIC      0x5350544EU     // "NTPS"
+#define NTPSYNC_PAGE_VERSION    5
+#define NTPSYNC_PAGE_SIZE       4096
+#define NTPSYNC_PAGE_RETRIES    1000000         // a writer never holds the page for this long
+
+// The offset goes linearly from "from" (at local time start) to its target (at local time end)
+typedef struct {
+    int64_t start;              // [local ns]
+    int64_t end;                // [local ns]
+    int64_t from;               // [ns]
+    int64_t rate;               // signed 32.32 fixed point [ns/ns]
+} tNtpSyncSlew;
+
+// unix ns = tzero_wck + (local ns - tzero_sys) + offset slewed at local ns + (local ns - tsync_sys) * freq
+typedef struct {
+    uint64_t tzero_ntp_wck;     // tzero_wck in ntp 32.32 format
+    int64_t tzero_wck;          // [unix ns]
+    int64_t tzero_sys;          // local monotonic clock [ns]
+    int64_t offset;             // target offset [ns]
+    tNtpSyncSlew slew;
+    int64_t tsync_sys;          // local clock of the last adjustment [ns]
+    int64_t freq;               // local clock frequency correction, signed 32.32 fixed point [ns/ns]
+    tTscScale tsc;              // local clock from the tsc...
+    int32_t use_tsc;            // ...when set
+    int32_t reserved;
+    int64_t coarse_ofs;         // local clock - coarse clock, at coarse_t [ns]
+    int64_t coarse_res;         // resolution of the coarse clock [ns]
+    int64_t coarse_err;         // error bound of the time read from the coarse clock [ns]
+    int64_t coarse_rate;        // drift of coarse_ofs, signed 32.32 fixed point [ns/ns]
+    int64_t coarse_t;           // local clock of the coarse clock measurement [ns]
+} tNtpSyncTimebase;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;              // sizeof(tNtpSyncPage) of the writer
+    uint32_t synchronised;      // cleared when the writer stops
+    uint32_t seq;               // sequence lock: odd while the writer is updating tb
+    uint32_t reserved;
+    tNtpSyncTimebase tb;
+} tNtpSyncPage;
+
+// Per thread copy of the timebase, refreshed only when the writer publishes a new one
+typedef struct {
+    const tNtpSyncPage *page;
+    uint32_t seq;
+    tNtpSyncTimebase tb;
+} tNtpSyncTbCache;
+
+// The local clock and its coarse (cheaper, tick based) flavour
+#ifdef __APPLE__
+    #define NTPSYNC_PAGE_CLOCK          CLOCK_UPTIME_RAW
+    #define NTPSYNC_PAGE_COARSE_CLOCK   CLOCK_UPTIME_RAW_APPROX
+#else
+    #ifdef CLOCK_MONOTONIC_RAW
+        #define NTPSYNC_PAGE_CLOCK      CLOCK_MONOTONIC_RAW
+    #else
+        #define NTPSYNC_PAGE_CLOCK      CLOCK_MONOTONIC
+    #endif
+
+    #ifdef CLOCK_MONOTONIC_COARSE
+        #define NTPSYNC_PAGE_COARSE_CLOCK   CLOCK_MONOTONIC_COARSE
+    #else
+        #define NTPSYNC_PAGE_COARSE_CLOCK   NTPSYNC_PAGE_CLOCK
+    #endif
+#endif
+
+#define NTPSYNC_PAGE_GETTIME(clk) ({ \
+    struct timespec tp; \
+    clock_gettime(clk, &tp); \
+    (int64_t)tp.tv_sec * 1000000000LL + tp.tv_nsec; \
+})
+
+#define NTPSYNC_PAGE_NSECS()        NTPSYNC_PAGE_GETTIME(NTPSYNC_PAGE_CLOCK)
+#define NTPSYNC_PAGE_COARSE_NSECS() NTPSYNC_PAGE_GETTIME(NTPSYNC_PAGE_COARSE_CLOCK)
+
+// a * q / 2^32, for |q| < 2^32
+NTPSYNC_INLINE int64_t ntp_sync_mul_q32(int64_t a, int64_t q) {
+    uint64_t n = a < 0 ? -(uint64_t)a : (uint64_t)a;
+    uint64_t m = q < 0 ? -(uint64_t)q : (uint64_t)q;
+    uint64_t r = (n >> 32) * m + (((n & 0xFFFFFFFF) * m) >> 32);
+
+    return (a < 0) != (q < 0) ? -(int64_t)r : (int64_t)r;
+}
+
+// Offset at the local time now, evaluated at read time: no stepping, time is smooth at any resolution
+NTPSYNC_INLINE int64_t ntp_sync_slew_offset(const tNtpSyncSlew *s, int64_t offset, int64_t now) {
+
+    if (__builtin_expect(now >= s->end, 1))
+        return offset;
+
+    return now <= s->start ? s->from : s->from + ntp_sync_mul_q32(now - s->start, s->rate);
+}
+
+// Offset of the synchronised time from the local clock at local time now [ns]
+NTPSYNC_INLINE int64_t ntp_sync_page_tb_offset(const tNtpSyncTimebase *tb, int64_t now) {
+    return ntp_sync_slew_offset(&tb->slew, tb->offset, now) + ntp_sync_mul_q32(now - tb->tsync_sys, tb->freq);
+}
+
+// Local clock in the domain of tb->tzero_sys
+NTPSYNC_INLINE int64_t ntp_sync_page_local_ns(const tNtpSyncTimebase *tb) {
+#if TSC_SUPPORTED
+    if (tb->use_tsc)
+        return tsc_2_ns(&tb->tsc, tsc_read());
+#endif
+    return NTPSYNC_PAGE_NSECS();
+}
+
+// Copy a consistent timebase out of the page. Returns 0 on success, 1 if the writer looks dead halfway an update.
+// Readers never write to the page: they only retry when a publish overlapped the copy.
+NTPSYNC_INLINE int ntp_sync_page_read_seq(const tNtpSyncPage *p, tNtpSyncTimebase *tb, uint32_t *pSeq) {
+    uint32_t seq;
+    int n = 0;
+
+    do {
+        while (((seq = __atomic_load_n(&p->seq, __ATOMIC_ACQUIRE)) & 1) && ++n < NTPSYNC_PAGE_RETRIES)
+            ;
+        memcpy(tb, &p->tb, sizeof(tNtpSyncTimebase)); // the fence keeps the copy in between the two loads of seq
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while (__atomic_load_n(&p->seq, __ATOMIC_RELAXED) != seq);
+
+    *pSeq = seq;
+    return n >= NTPSYNC_PAGE_RETRIES;
+}
+
+NTPSYNC_INLINE int ntp_sync_page_read(const tNtpSyncPage *p, tNtpSyncTimebase *tb) {
+    uint32_t seq;
+
+    return ntp_sync_page_read_seq(p, tb, &seq);
+}
+
+// Timebase through a (thread local) cache: as long as the writer doesn't publish, the only access
+// to the page is the load of seq, whose cache line stays shared among all the cores.
+NTPSYNC_INLINE const tNtpSyncTimebase *ntp_sync_page_cached(const tNtpSyncPage *p, tNtpSyncTbCache *c) {
+
+    if (__builtin_expect(__atomic_load_n(&p->seq, __ATOMIC_ACQUIRE) != c->seq || p != c->page, 0)) {
+        ntp_sync_page_read_seq(p, &c->tb, &c->seq);
+        c->page = p;
+    }
+    return &c->tb;
+}
+
+NTPSYNC_INLINE int64_t ntp_sync_page_tb_time_ns(const tNtpSyncTimebase *tb) {
+    int64_t now = ntp_sync_page_local_ns(tb);
+
+    return tb->tzero_wck + (now - tb->tzero_sys) + ntp_sync_page_tb_offset(tb, now);
+}
+
+// Synchronised unix time [ns]
+NTPSYNC_INLINE int64_t ntp_sync_page_time_ns(const tNtpSyncPage *p) {
+    tNtpSyncTimebase tb;
+
+    ntp_sync_page_read(p, &tb);
+    return ntp_sync_page_tb_time_ns(&tb);
+}
+
+// Synchronised unix time from the coarse clock [ns]: cheaper, but only accurate within tb.coarse_err
+NTPSYNC_INLINE int64_t ntp_sync_page_tb_time_coarse_ns(const tNtpSyncTimebase *tb) {
+    int64_t now = NTPSYNC_PAGE_COARSE_NSECS() + tb->coarse_ofs;
+
+    now += ntp_sync_mul_q32(now - tb->coarse_t, tb->coarse_rate);
+    return tb->tzero_wck + (now - tb->tzero_sys) + ntp_sync_page_tb_offset(tb, now);
+}
+
+NTPSYNC_INLINE int64_t ntp_sync_page_time_coarse_ns(const tNtpSyncPage *p) {
+    tNtpSyncTimebase tb;
+
+    ntp_sync_page_read(p, &tb);
+    return ntp_sync_page_tb_time_coarse_ns(&tb);
+}
+
+NTPSYNC_INLINE int ntp_sync_page_synchronised(const tNtpSyncPage *p) {
+    return (int)__atomic_load_n(&p->synchronised, __ATOMIC_ACQUIRE);
+}
+
+// Map read only the page published by another process: NULL if missing or of an unknown layout
+NTPSYNC_INLINE tNtpSyncPage *ntp_sync_page_open(const char *name) {
+    tNtpSyncPage *p;
+    int fd = shm_open(name, O_RDONLY, 0);
+
+    if (fd < 0)
+        return NULL;
+
+    p = (tNtpSyncPage *)mmap(NULL, NTPSYNC_PAGE_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (p == MAP_FAILED)
+        return NULL;
+
+    if (__atomic_load_n(&p->magic, __ATOMIC_ACQUIRE) != NTPSYNC_PAGE_MAGIC ||
+        p->version != NTPSYNC_PAGE_VERSION || p->size < sizeof(tNtpSyncPage)) {
+        munmap(p, NTPSYNC_PAGE_SIZE);
+        return NULL;
+    }
+    return p;
+}
+
+NTPSYNC_INLINE void ntp_sync_page_close(tNtpSyncPage *p) {
+    if (p != NULL)
+        munmap(p, NTPSYNC_PAGE_SIZE);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
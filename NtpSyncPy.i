@@ -4,4 +4,5 @@
 #include "NtpSync.h"
 %}
 
+%include "stdint.i"
 %include "NtpSync.h"
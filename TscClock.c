@@ -0,0 +1,194 @@
+//
+//  TscClock.c
+//
+//  Author: Filippin luca
+//  luca.filippin@gmail.com
+//
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "TscClock.h"
+
+#define DEBUG_BASIC     0x01
+#define DEBUG_MEDIUM    0x02
+#define DEBUG_DEEP      0x04
+
+#define DEBUG_SWITCH    DEBUG_BASIC + DEBUG_MEDIUM
+#include "DebugUtil.h"
+
+#define TSCCLOCK_HEADER   "TSC-CLOCK"
+#define TSCCLOCK_DBG(fmt, ...) eprintf(TSCCLOCK_HEADER, fmt, __VA_ARGS__)
+
+#define TSC_TRIALS          20
+#define TSC_CALIB_US        20000       // first calibration baseline
+#define TSC_MAX_SKEW_NS     1000        // max tolerated disagreement among cores
+#define TSC_MAX_ERR_NS      2000        // max tolerated extrapolation error...
+#define TSC_MAX_ERR_PPM     50          // ...plus this much per elapsed second
+#define TSC_SLEW_MIN_NS     1000000000LL // the error of a calibration is absorbed over at least this long
+
+#if TSC_SUPPORTED
+
+#include <pthread.h>
+#include <sched.h>
+#include <cpuid.h>
+
+#define TSC_CLOCKSOURCE "/sys/devices/system/clocksource/clocksource0/current_clocksource"
+
+// Take a (counter, reference) couple, picking the read which has been least disturbed
+static void _tsc_pair(tTscRefClock ref, uint64_t *pTsc, int64_t *pNs) {
+    uint64_t t0, t1, width = UINT64_MAX;
+    int64_t ns;
+    int i;
+
+    for (i = 0; i < TSC_TRIALS; i++) {
+        t0 = tsc_read();
+        ns = ref();
+        t1 = tsc_read();
+
+        if (t1 - t0 < width) {
+            width = t1 - t0;
+            *pTsc = t0 + width / 2;
+            *pNs = ns;
+        }
+    }
+}
+
+// Scale on the longest baseline, for the reference clock read ns at tsc. The clock goes on from at, its
+// value on the previous scale, err ahead of the reference: rather than jumping back onto the reference,
+// the slope absorbs err over the next horizon ns, so that the clock stays continuous and monotonic.
+static void _tsc_scale(tTscClock *pTsc, uint64_t tsc, int64_t ns, int64_t at, int64_t err, int64_t horizon) {
+    // not in the read path: the double is precise enough for a 32.32 factor close to 1
+    double rate = (double)(ns - pTsc->ns0) / (double)(tsc - pTsc->tsc0);
+
+    pTsc->scale.mult = (uint64_t)(rate * (1 - (double)err / horizon) * 4294967296.0);
+    pTsc->scale.tsc = tsc;
+    pTsc->scale.ns = at;
+}
+
+int tsc_clock_supported() {
+    unsigned int eax, ebx, ecx, edx;
+    char src[32] = "";
+    FILE *f;
+
+    // invariant tsc: constant rate in all the ACPI P/C/T states
+    if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) || !(edx & (1 << 8))) {
+        DEBUG_LEVEL(DEBUG_BASIC, TSCCLOCK_DBG("%s", "-- Invariant TSC not available\n"));
+        return 0;
+    }
+
+    // the kernel drops the tsc clocksource as soon as it finds it unstable
+    if ((f = fopen(TSC_CLOCKSOURCE, "r")) != NULL) {
+        if (fgets(src, sizeof(src), f) == NULL)
+            src[0] = '\0';
+        fclose(f);
+
+        if (strncmp(src, "tsc", 3) != 0) {
+            DEBUG_LEVEL(DEBUG_BASIC, TSCCLOCK_DBG("-- Kernel clocksource is %s", src));
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Verify that all the cores we may run on agree on the counter
+static int _tsc_check_cores(tTscClock *pTsc, tTscRefClock ref) {
+    cpu_set_t orig, cpu;
+    int64_t ns, err, err_min = INT64_MAX, err_max = INT64_MIN;
+    uint64_t tsc;
+    int i, rc = 1;
+
+    if (pthread_getaffinity_np(pthread_self(), sizeof(orig), &orig) != 0)
+        return 0;
+
+    for (i = 0; i < CPU_SETSIZE; i++) {
+        if (!CPU_ISSET(i, &orig))
+            continue;
+
+        CPU_ZERO(&cpu);
+        CPU_SET(i, &cpu);
+
+        if (pthread_setaffinity_np(pthread_self(), sizeof(cpu), &cpu) != 0) {
+            rc = 0;
+            break;
+        }
+
+        _tsc_pair(ref, &tsc, &ns);
+        err = tsc_2_ns(&pTsc->scale, tsc) - ns;
+        err_min = err < err_min ? err : err_min;
+        err_max = err > err_max ? err : err_max;
+        DEBUG_LEVEL(DEBUG_DEEP, TSCCLOCK_DBG("-- cpu %d: error = %lld ns\n", i, (long long)err));
+    }
+
+    pthread_setaffinity_np(pthread_self(), sizeof(orig), &orig);
+
+    if (rc && err_max - err_min > TSC_MAX_SKEW_NS) {
+        DEBUG_LEVEL(DEBUG_BASIC, TSCCLOCK_DBG("-- TSC not synchronised among cores (skew = %lld ns)\n", (long long)(err_max - err_min)));
+        rc = 0;
+    }
+    return rc;
+}
+
+int tsc_clock_init(tTscClock *pTsc, tTscRefClock ref) {
+    uint64_t tsc;
+    int64_t ns;
+
+    memset(pTsc, 0, sizeof(tTscClock));
+
+    if (!tsc_clock_supported())
+        return 1;
+
+    _tsc_pair(ref, &pTsc->tsc0, &pTsc->ns0);
+    usleep(TSC_CALIB_US);
+    _tsc_pair(ref, &tsc, &ns);
+    _tsc_scale(pTsc, tsc, ns, ns, 0, TSC_SLEW_MIN_NS);
+
+    if (!_tsc_check_cores(pTsc, ref))
+        return 1;
+
+    pTsc->valid = 1;
+    DEBUG_LEVEL(DEBUG_MEDIUM, TSCCLOCK_DBG("-- TSC clock enabled: %.6f ns per tick\n", (double)pTsc->scale.mult / 4294967296.0));
+    return 0;
+}
+
+int tsc_clock_calibrate(tTscClock *pTsc, tTscRefClock ref) {
+    uint64_t tsc;
+    int64_t ns, at, err, elapsed;
+
+    if (!pTsc->valid)
+        return 1;
+
+    _tsc_pair(ref, &tsc, &ns);
+    at = tsc_2_ns(&pTsc->scale, tsc);
+    err = at - ns;
+    elapsed = ns - pTsc->scale.ns;
+
+    DEBUG_LEVEL(DEBUG_DEEP, TSCCLOCK_DBG("-- TSC error = %lld ns after %lld ns\n", (long long)err, (long long)elapsed));
+
+    if ((err < 0 ? -err : err) > TSC_MAX_ERR_NS + elapsed / 1000000 * TSC_MAX_ERR_PPM) {
+        DEBUG_LEVEL(DEBUG_BASIC, TSCCLOCK_DBG("-- TSC drifted away from the reference clock (%lld ns): disabled\n", (long long)err));
+        pTsc->valid = 0;
+        return 1;
+    }
+
+    _tsc_scale(pTsc, tsc, ns, at, err, elapsed > TSC_SLEW_MIN_NS ? elapsed : TSC_SLEW_MIN_NS);
+    return 0;
+}
+
+#else
+
+int tsc_clock_supported() {
+    return 0;
+}
+
+int tsc_clock_init(tTscClock *pTsc, tTscRefClock ref) {
+    memset(pTsc, 0, sizeof(tTscClock));
+    return 1;
+}
+
+int tsc_clock_calibrate(tTscClock *pTsc, tTscRefClock ref) {
+    return 1;
+}
+
+#endif
@@ -0,0 +1,77 @@
+//
+//  TscClock.h
+//
+//  Author: Filippin luca
+//  luca.filippin@gmail.com
+//
+//  Time stamp counter clock source: the counter is scaled to ns and kept aligned
+//  to a reference clock (CLOCK_MONOTONIC_RAW) by periodic calibrations.
+//  Reading it costs a few ns against the hundreds of a clock_gettime() syscall.
+//
+
+#ifndef __TSCCLOCK_H__
+#define __TSCCLOCK_H__
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if !defined(TSC_INLINE)
+    #if defined(__GNUC__)
+        #define TSC_INLINE static __inline__ __attribute__((always_inline))
+    #else
+        #define TSC_INLINE static __inline
+    #endif
+#endif
+
+#if defined(__linux__) && (defined(__x86_64__) || defined(__i386__))
+    #define TSC_SUPPORTED 1
+#else
+    #define TSC_SUPPORTED 0
+#endif
+
+typedef int64_t (*tTscRefClock)(void);
+
+typedef struct {
+    uint64_t tsc;       // counter at the calibration point
+    int64_t ns;         // clock at the calibration point, within the calibration error of the reference [ns]
+    uint64_t mult;      // ns per tick, 32.32 fixed point: it also slews that error off
+} tTscScale;
+
+typedef struct {
+    tTscScale scale;
+    uint64_t tsc0;      // first calibration point: mult is evaluated on the longest available baseline
+    int64_t ns0;
+    int valid;
+} tTscClock;
+
+int tsc_clock_supported();
+int tsc_clock_init(tTscClock *pTsc, tTscRefClock ref);
+int tsc_clock_calibrate(tTscClock *pTsc, tTscRefClock ref);
+
+#if TSC_SUPPORTED
+
+TSC_INLINE uint64_t tsc_read() {
+    uint32_t lo, hi;
+    // lfence keeps rdtsc from being executed ahead of the preceding instructions
+    __asm__ __volatile__("lfence\n\trdtsc" : "=a"(lo), "=d"(hi) :: "memory");
+    return ((uint64_t)hi << 32) | lo;
+}
+
+#endif
+
+TSC_INLINE int64_t tsc_2_ns(const tTscScale *p, uint64_t tsc) {
+    int64_t d = (int64_t)(tsc - p->tsc);
+    uint64_t a = d < 0 ? -(uint64_t)d : (uint64_t)d;
+    uint64_t ns = (a >> 32) * p->mult + (((a & 0xFFFFFFFF) * p->mult) >> 32);
+
+    return d < 0 ? p->ns - (int64_t)ns : p->ns + (int64_t)ns;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -5,16 +5,25 @@
 //  luca.filippin@gmail.com
 //
 
+#define _GNU_SOURCE
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <poll.h>
 #include <netdb.h>
 #include <string.h>
 #include <errno.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
 #include "UdpConn.h"
 
+#ifdef __linux__
+    #include <linux/net_tstamp.h>
+    #include <linux/errqueue.h>
+#endif
+
 #define DEBUG_BASIC     0x01
 #define DEBUG_MEDIUM    0x02
 #define DEBUG_DEEP      0x04
@@ -47,17 +56,23 @@
 
 #endif
 
+// getaddrinfo rather than gethostbyname, whose static result the starts on other threads may overwrite
 int udp_open(char *address, int port, int timeout_ms) {
     int s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
 
     if (s > 0) {
-        struct hostent *host = gethostbyname(address);
+        struct addrinfo hints, *res = NULL;
+        int rc;
 
-        if (host != NULL) {
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_DGRAM;
+
+        if ((rc = getaddrinfo(address, NULL, &hints, &res)) == 0) {
             struct sockaddr_in addr;
             struct timeval tv;
-            memset((char *)&addr, 0, sizeof(addr));
-            memcpy(&addr.sin_addr, host->h_addr, sizeof(addr.sin_addr));
+            memcpy(&addr, res->ai_addr, sizeof(addr));
+            freeaddrinfo(res);
             addr.sin_family = AF_INET;
             addr.sin_port = htons(port);
 
@@ -68,9 +83,10 @@ int udp_open(char *address, int port, int timeout_ms) {
                 setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) == 0 &&
                 connect(s, (struct sockaddr *)&addr, sizeof(struct sockaddr)) == 0)
                 return s;
+        } else
+            DEBUG_LEVEL(DEBUG_BASIC, UDPCONN_DBG("-- Error: can't resolve %s (%s)\n", address, gai_strerror(rc)));
 
-            close(s);
-        }
+        close(s);
     }
     return -1;
 }
@@ -95,11 +111,86 @@ int udp_send(int s, char *buffer, int len) {
     return n;
 }
 
+int udp_set_rx_timestamps(int s) {
+    int on = 1;
+
+#if defined(SO_TIMESTAMPNS)
+    return setsockopt(s, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on));
+#elif defined(SO_TIMESTAMP)
+    return setsockopt(s, SOL_SOCKET, SO_TIMESTAMP, &on, sizeof(on));
+#else
+    return 1;
+#endif
+}
+
+#define UDP_MAX_AGE     1000000000LL    // [ns] older than this, the realtime clock stepped in between
+
+// The kernel timestamps are taken from the realtime clock: what matters is how old they are
+static int64_t _ts_age(struct timespec *pTs) {
+    struct timespec now;
+    int64_t age;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    age = (int64_t)(now.tv_sec - pTs->tv_sec) * 1000000000LL + (now.tv_nsec - pTs->tv_nsec);
+    return age >= 0 && age < UDP_MAX_AGE ? age : -1;
+}
+
+static int64_t _rx_age(struct msghdr *pMsg) {
+    struct cmsghdr *c;
+    struct timespec rx;
+    int found = 0;
+
+    for (c = CMSG_FIRSTHDR(pMsg); c != NULL; c = CMSG_NXTHDR(pMsg, c)) {
+        if (c->cmsg_level != SOL_SOCKET)
+            continue;
+#if defined(SO_TIMESTAMPNS)
+        if (c->cmsg_type == SCM_TIMESTAMPNS) {
+            memcpy(&rx, CMSG_DATA(c), sizeof(rx));
+            found = 1;
+        }
+#elif defined(SO_TIMESTAMP)
+        if (c->cmsg_type == SCM_TIMESTAMP) {
+            struct timeval tv;
+            memcpy(&tv, CMSG_DATA(c), sizeof(tv));
+            rx.tv_sec = tv.tv_sec;
+            rx.tv_nsec = tv.tv_usec * 1000;
+            found = 1;
+        }
+#endif
+    }
+
+    return found ? _ts_age(&rx) : -1;
+}
+
 int udp_receive(int s, char *buffer, int len) {
-    int n = (int)recv(s, buffer, len, 0);
+    return udp_receive_ts(s, buffer, len, NULL);
+}
+
+int udp_receive_ts(int s, char *buffer, int len, int64_t *pAge) {
+    union {
+        struct cmsghdr align;
+        char buf[256];
+    } ctrl;
+    struct msghdr msg;
+    struct iovec iov;
+    int n;
+
+    iov.iov_base = buffer;
+    iov.iov_len = len;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctrl.buf;
+    msg.msg_controllen = sizeof(ctrl.buf);
+
+    n = (int)recvmsg(s, &msg, 0);
+
+    if (pAge != NULL)
+        *pAge = n < 0 ? -1 : _rx_age(&msg);
 
     if (n < 0) {
-        DEBUG_LEVEL(DEBUG_BASIC, UDPCONN_DBG("-- Error: failed to receive data (%d)\n", errno));
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+            DEBUG_LEVEL(DEBUG_BASIC, UDPCONN_DBG("-- Error: failed to receive data (%d)\n", errno));
     } else {
         DEBUG_OPEN(DEBUG_MEDIUM)
         char buff[256];
@@ -110,3 +201,110 @@ int udp_receive(int s, char *buffer, int len) {
 
     return n;
 }
+
+int udp_set_nonblocking(int s) {
+    int flags = fcntl(s, F_GETFL, 0);
+
+    return flags < 0 ? -1 : fcntl(s, F_SETFL, flags | O_NONBLOCK);
+}
+
+int udp_wait(int s, int timeout_us) {
+    int ready;
+
+    return udp_wait_any(&s, 1, timeout_us, &ready);
+}
+
+// poll rather than select: the descriptors of a host process may well be past FD_SETSIZE.
+// The error queue (the transmit timestamps) shows as POLLERR.
+int udp_wait_any(int *s, int n, int timeout_us, int *ready) {
+    struct pollfd fds[n > 0 ? n : 1];
+#ifdef __linux__
+    struct timespec ts = { timeout_us / 1000000, (long)(timeout_us % 1000000) * 1000 };
+#endif
+    int i, rc;
+
+    for (i = 0; i < n; i++) {
+        fds[i].fd = s[i];
+        fds[i].events = POLLIN;
+        fds[i].revents = 0;
+    }
+
+#ifdef __linux__
+    rc = ppoll(fds, n, &ts, NULL); // to the us: the requests of a burst are spaced by less than a ms
+#else
+    rc = poll(fds, n, (timeout_us + 999) / 1000);
+#endif
+
+    if (rc < 0 && errno != EINTR)
+        DEBUG_LEVEL(DEBUG_BASIC, UDPCONN_DBG("-- Error: failed to wait for data (%d)\n", errno));
+
+    for (i = 0; i < n; i++)
+        ready[i] = rc > 0 && (fds[i].revents & (POLLIN | POLLERR)) != 0;
+
+    return rc < 0 ? (errno == EINTR ? 0 : -1) : rc;
+}
+
+#if defined(SO_TIMESTAMPING) && defined(__linux__)
+
+int udp_set_tx_timestamps(int s) {
+    int flags = SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY;
+
+    return setsockopt(s, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags));
+}
+
+int udp_receive_tx_ts(int s, uint32_t *pId, int64_t *pAge, int *pErr) {
+    union {
+        struct cmsghdr align;
+        char buf[256];
+    } ctrl;
+    struct scm_timestamping tss;
+    struct sock_extended_err err;
+    struct msghdr msg;
+    struct cmsghdr *c;
+    int found = 0;
+
+    *pErr = 0;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_control = ctrl.buf;
+    msg.msg_controllen = sizeof(ctrl.buf);
+
+    if (recvmsg(s, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return 0;
+
+        DEBUG_LEVEL(DEBUG_BASIC, UDPCONN_DBG("-- Error: failed to read the error queue (%d)\n", errno));
+        return -1;
+    }
+
+    for (c = CMSG_FIRSTHDR(&msg); c != NULL; c = CMSG_NXTHDR(&msg, c)) {
+        if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_TIMESTAMPING) {
+            memcpy(&tss, CMSG_DATA(c), sizeof(tss));
+            found |= 1;
+        } else
+        if ((c->cmsg_level == SOL_IP && c->cmsg_type == IP_RECVERR) || (c->cmsg_level == SOL_IPV6 && c->cmsg_type == IPV6_RECVERR)) {
+            memcpy(&err, CMSG_DATA(c), sizeof(err));
+
+            if (err.ee_origin == SO_EE_ORIGIN_TIMESTAMPING)
+                found |= err.ee_errno == ENOMSG ? 2 : 0;
+            else // ie. the port unreachable of the server
+                *pErr = err.ee_errno;
+        }
+    }
+
+    *pId = found == 3 ? err.ee_data : 0;
+    *pAge = found == 3 ? _ts_age(&tss.ts[0]) : -1;
+    return 1;
+}
+
+#else
+
+int udp_set_tx_timestamps(int s) {
+    return 1;
+}
+
+int udp_receive_tx_ts(int s, uint32_t *pId, int64_t *pAge, int *pErr) {
+    *pErr = 0;
+    return 0;
+}
+
+#endif
@@ -8,9 +8,32 @@
 #ifndef __UDPCONN_H__
 #define __UDPCONN_H__
 
+#include <stdint.h>
+
 int udp_open(char *address, int port, int timeout_ms);
 void udp_close(int s);
 int udp_send(int s, char *buffer, int len);
 int udp_receive(int s, char *buffer, int len);
+int udp_wait(int s, int timeout_us);    // 1 if data can be received, 0 on timeout, -1 on error
+// Have the receive calls return at once (-1, errno EAGAIN) when there is nothing to read: 0 on success
+int udp_set_nonblocking(int s);
+// As udp_wait, on n sockets: returns how many are ready, flagging them in ready
+int udp_wait_any(int *s, int n, int timeout_us, int *ready);
+
+// Have the kernel timestamp the datagrams as they are received: 0 if supported
+int udp_set_rx_timestamps(int s);
+// As udp_receive, also returning how long ago the kernel received the datagram [ns] (NULL
+// is fine): -1 if the kernel didn't timestamp it. Subtracted from the current time of any
+// clock, it gives the receive time in that clock domain.
+int udp_receive_ts(int s, char *buffer, int len, int64_t *pAge);
+
+// Have the kernel timestamp the datagrams as they leave (software timestamps): 0 if supported.
+// The timestamps are queued on the socket error queue, which makes udp_wait return.
+int udp_set_tx_timestamps(int s);
+// Read one entry of the error queue without blocking: 1 if any, 0 if none, -1 on error.
+// *pId is the number of datagrams sent before the timestamped one, since udp_set_tx_timestamps;
+// *pAge as in udp_receive_ts, -1 if the entry is not a transmit timestamp. *pErr is the errno of an
+// entry which is an error instead (ie. ECONNREFUSED), 0 otherwise.
+int udp_receive_tx_ts(int s, uint32_t *pId, int64_t *pAge, int *pErr);
 
 #endif
@@ -1,5 +1,15 @@
 #!/bin/bash
 
+# ./makeit.sh test: build and run the known answer tests of the modules
+if [ "$1" == "test" ]; then
+  mkdir -p build/test
+  for t in "NtpSelectTest NtpSelect.c" "NtpFilterTest NtpFilter.c" "NtpKalmanTest NtpKalman.c" "NtpStateTest NtpState.c"; do
+    set -- $t
+    gcc -O2 $1.c ${@:2} DebugUtil.c -lm -o build/test/$1 && build/test/$1 2>/dev/null || exit 1
+  done
+  exit 0
+fi
+
 rm -f _NtpSyncPy.so
 rm -rf build
 rm -f *.pyc
@@ -24,7 +24,7 @@ if platform.find('macosx') == 0:
 
     NtpSync_module = Extension('_NtpSyncPy',
                                 define_macros = [('MAJOR_VERSION', '1'),('MINOR_VERSION', '0')],
-                                sources = ['NtpSyncPy_wrap.c', 'UdpConn.c', 'NtpSync.c', 'DebugUtil.c'],
+                                sources = ['NtpSyncPy_wrap.c', 'UdpConn.c', 'NtpSync.c', 'NtpFilter.c', 'NtpSelect.c', 'NtpKalman.c', 'NtpState.c', 'TscClock.c', 'DebugUtil.c'],
                                 include_dirs = [],
                                 library_dirs = ['/System/Library/Frameworks/CoreServices.framework'],
                                 libraries = ['pthread'],
@@ -35,10 +35,10 @@ elif platform.find('linux') == 0:
 
     NtpSync_module = Extension('_NtpSyncPy',
                                 define_macros = [('MAJOR_VERSION', '1'),('MINOR_VERSION', '0')],
-                                sources = ['NtpSyncPy_wrap.c', 'UdpConn.c', 'NtpSync.c', 'DebugUtil.c'],
+                                sources = ['NtpSyncPy_wrap.c', 'UdpConn.c', 'NtpSync.c', 'NtpFilter.c', 'NtpSelect.c', 'NtpKalman.c', 'NtpState.c', 'TscClock.c', 'DebugUtil.c'],
                                 include_dirs = [],
                                 library_dirs = [],
-                                libraries = [ 'pthread', 'rt' ],
+                                libraries = [ 'pthread', 'rt', 'm' ],
                                 extra_compile_args = [],
                                 extra_link_args = [])
 else: